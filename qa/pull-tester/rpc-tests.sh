@@ -17,8 +17,10 @@ testScripts=(
     'wallet.py'
     'wallet_nullifiers.py'
     'wallet_1941.py'
+    'wallet_sendbatch.py'
     'listtransactions.py'
     'mempool_resurrect_test.py'
+    'addressindex_reorg.py'
     'txn_doublespend.py'
     'txn_doublespend.py --mineblock'
     'getchaintips.py'
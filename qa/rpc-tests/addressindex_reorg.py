@@ -0,0 +1,121 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Safecoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that -addressindex, -spentindex and -timestampindex follow a reorg:
+# disconnected blocks drop out of the indexes, their transactions show up
+# in the mempool indexes again, and reconnecting restores everything.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+COIN = 100000000
+
+class AddressIndexReorgTest (BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self, split=False):
+        args = ['-addressindex', '-spentindex', '-timestampindex', '-checkmempool']
+        self.nodes = start_nodes(2, self.options.tmpdir, extra_args=[args] * 2)
+        connect_nodes_bi(self.nodes,0,1)
+        self.is_network_split=False
+        self.sync_all()
+
+    def assert_indexed(self, node, addr, balance, received, heights):
+        query = {"addresses": [addr]}
+        assert_equal(node.getaddressbalance(query), {"balance": balance, "received": received})
+        deltas = node.getaddressdeltas(query)
+        assert_equal([d['height'] for d in deltas], heights)
+        utxos = node.getaddressutxos(query)
+        assert_equal(sum(u['satoshis'] for u in utxos), balance)
+
+    def run_test (self):
+        print "Mining blocks..."
+
+        self.nodes[0].generate(101)
+        self.sync_all()
+
+        addr = self.nodes[1].getnewaddress()
+        self.assert_indexed(self.nodes[0], addr, 0, 0, [])
+
+        # Pay the address; the payment is indexed by the mempool first
+        txid1 = self.nodes[0].sendtoaddress(addr, 10)
+        tx1 = self.nodes[0].getrawtransaction(txid1, 1)
+        vout1 = [o['n'] for o in tx1['vout'] if addr in o['scriptPubKey'].get('addresses', [])][0]
+        prevout = tx1['vin'][0]
+        self.sync_all()
+        mempool = self.nodes[0].getaddressmempool({"addresses": [addr]})
+        assert_equal(len(mempool), 1)
+        assert_equal(mempool[0]['satoshis'], 10 * COIN)
+        spent = self.nodes[0].getspentinfo({"txid": prevout['txid'], "index": prevout['vout']})
+        assert_equal(spent['txid'], txid1)
+        assert_equal(spent['height'], -1)
+
+        block1 = self.nodes[0].generate(1)[0]
+        self.sync_all()
+        self.assert_indexed(self.nodes[0], addr, 10 * COIN, 10 * COIN, [102])
+        assert_equal(self.nodes[0].getaddressmempool({"addresses": [addr]}), [])
+        assert_equal(self.nodes[0].getspentinfo({"txid": prevout['txid'], "index": prevout['vout']})['height'], 102)
+
+        # Spend it again from node 1, in a block mined there
+        txid2 = self.nodes[1].sendtoaddress(self.nodes[0].getnewaddress(), 5)
+        self.sync_all()
+        block2 = self.nodes[1].generate(1)[0]
+        self.sync_all()
+        self.assert_indexed(self.nodes[0], addr, 0, 10 * COIN, [102, 103])
+        spent = self.nodes[0].getspentinfo({"txid": txid1, "index": vout1})
+        assert_equal(spent['txid'], txid2)
+        assert_equal(spent['height'], 103)
+        time2 = self.nodes[0].getblock(block2)['time']
+        assert(block2 in self.nodes[0].getblockhashes(time2 + 1, time2))
+
+        # Disconnect the spend: the output is unspent in the chain again and
+        # the spend is back to a mempool one
+        print "Invalidating the spending block..."
+        for node in self.nodes:
+            node.invalidateblock(block2)
+        assert_equal(self.nodes[0].getrawmempool(), [txid2])
+        self.assert_indexed(self.nodes[0], addr, 10 * COIN, 10 * COIN, [102])
+        spent = self.nodes[0].getspentinfo({"txid": txid1, "index": vout1})
+        assert_equal(spent['txid'], txid2)
+        assert_equal(spent['height'], -1)
+        mempool = self.nodes[0].getaddressmempool({"addresses": [addr]})
+        assert_equal([m['satoshis'] for m in mempool], [-10 * COIN])
+        assert(block2 not in self.nodes[0].getblockhashes(time2 + 1, time2))
+
+        # Disconnect the payment as well: nothing of the address is left in
+        # the chain, both transactions are indexed by the mempool
+        print "Invalidating the paying block..."
+        for node in self.nodes:
+            node.invalidateblock(block1)
+        assert_equal(set(self.nodes[0].getrawmempool()), set([txid1, txid2]))
+        self.assert_indexed(self.nodes[0], addr, 0, 0, [])
+        mempool = self.nodes[0].getaddressmempool({"addresses": [addr]})
+        assert_equal(sorted([m['satoshis'] for m in mempool]), [-10 * COIN, 10 * COIN])
+        spent = self.nodes[0].getspentinfo({"txid": prevout['txid'], "index": prevout['vout']})
+        assert_equal(spent['txid'], txid1)
+        assert_equal(spent['height'], -1)
+        time1 = self.nodes[0].getblock(block1)['time']
+        assert(block1 not in self.nodes[0].getblockhashes(time1 + 1, time1))
+
+        # Reconnecting both blocks restores the indexes and empties the mempool ones
+        print "Reconsidering the blocks..."
+        for node in self.nodes:
+            node.reconsiderblock(block2)
+        assert_equal(self.nodes[0].getbestblockhash(), block2)
+        assert_equal(self.nodes[0].getrawmempool(), [])
+        self.assert_indexed(self.nodes[0], addr, 0, 10 * COIN, [102, 103])
+        assert_equal(self.nodes[0].getaddressmempool({"addresses": [addr]}), [])
+        assert_equal(self.nodes[0].getspentinfo({"txid": prevout['txid'], "index": prevout['vout']})['height'], 102)
+        assert_equal(self.nodes[0].getspentinfo({"txid": txid1, "index": vout1})['height'], 103)
+        assert(block1 in self.nodes[0].getblockhashes(time1 + 1, time1))
+        assert(block2 in self.nodes[0].getblockhashes(time2 + 1, time2))
+
+if __name__ == '__main__':
+    AddressIndexReorgTest ().main ()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python2
+# Copyright (c) 2016 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test sendbatch, including batches that need more transactions than the
+# wallet has coins, which have to spend the change of earlier transactions.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+from time import *
+
+class WalletSendBatchTest (BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(2, self.options.tmpdir, extra_args=[['-debug=zrpc']] * 2)
+        connect_nodes_bi(self.nodes,0,1)
+        self.is_network_split=False
+        self.sync_all()
+
+    # Returns the operation result if it was a success or None
+    def wait_and_assert_operationid_status(self, myopid, in_status='success', in_errormsg=None):
+        print('waiting for async operation {}'.format(myopid))
+        opids = []
+        opids.append(myopid)
+        timeout = 300
+        status = None
+        errormsg = None
+        result = None
+        for x in xrange(1, timeout):
+            results = self.nodes[0].z_getoperationresult(opids)
+            if len(results)==0:
+                sleep(1)
+            else:
+                status = results[0]["status"]
+                if status == "failed":
+                    errormsg = results[0]['error']['message']
+                elif status == "success":
+                    result = results[0]['result']
+                break
+        print('...returned status: {}'.format(status))
+        assert_equal(in_status, status)
+        if errormsg is not None:
+            assert(in_errormsg is not None)
+            assert_equal(in_errormsg in errormsg, True)
+            print('...returned error: {}'.format(errormsg))
+        return result
+
+    def run_test (self):
+        print "Mining blocks..."
+
+        self.nodes[0].generate(101)
+        self.sync_all()
+
+        # sendbatch doesn't spend coinbases, so give node 0 a couple of
+        # ordinary coins: the payment and its change
+        self.nodes[0].sendtoaddress(self.nodes[0].getnewaddress(), 5)
+        self.nodes[0].generate(1)
+        self.sync_all()
+
+        coins = [u for u in self.nodes[0].listunspent() if 'generated' not in self.nodes[0].gettransaction(u['txid'])]
+        assert(len(coins) <= 2)
+
+        # Four transactions of two recipients each, more than there are coins
+        recipients = []
+        for i in xrange(8):
+            recipients.append({"address":self.nodes[1].getnewaddress(), "amount":Decimal('0.5')})
+        myopid = self.nodes[0].sendbatch(recipients, 1, 2)
+        result = self.wait_and_assert_operationid_status(myopid)
+        assert_equal(len(result['txids']), 4)
+        assert_equal(result['recipients'], 8)
+        assert('rejected' not in result)
+
+        # The later transactions spend the change of earlier ones
+        mempool = self.nodes[0].getrawmempool()
+        assert_equal(set(mempool), set(result['txids']))
+        chained = 0
+        for txid in result['txids']:
+            tx = self.nodes[0].getrawtransaction(txid, 1)
+            for vin in tx['vin']:
+                if vin['txid'] in result['txids']:
+                    chained += 1
+        assert(chained >= 4 - len(coins))
+
+        self.sync_all()
+        self.nodes[1].generate(1)
+        self.sync_all()
+        assert_equal(self.nodes[1].getbalance(), Decimal('4.0'))
+        assert_equal(len(self.nodes[0].getrawmempool()), 0)
+
+        # More than the wallet holds fails the whole batch, and leaves the
+        # coins spendable
+        balance = self.nodes[0].getbalance()
+        recipients = [{"address":self.nodes[1].getnewaddress(), "amount":Decimal('1.0')} for i in xrange(4)]
+        recipients.append({"address":self.nodes[1].getnewaddress(), "amount":balance})
+        myopid = self.nodes[0].sendbatch(recipients, 1, 2)
+        self.wait_and_assert_operationid_status(myopid, "failed", "Insufficient funds")
+        assert_equal(len(self.nodes[0].listlockunspent()), 0)
+        assert_equal(len(self.nodes[0].getrawmempool()), 0)
+
+if __name__ == '__main__':
+    WalletSendBatchTest ().main ()
@@ -94,6 +94,9 @@ case "$1" in
             trydecryptnotes)
                 zcash_rpc zcbenchmark trydecryptnotes 1000 "${@:3}"
                 ;;
+            trydecryptnotesunbatched)
+                zcash_rpc zcbenchmark trydecryptnotesunbatched 1000 "${@:3}"
+                ;;
             incnotewitnesses)
                 zcash_rpc zcbenchmark incnotewitnesses 100 "${@:3}"
                 ;;
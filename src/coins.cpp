@@ -268,6 +268,15 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
+void CCoinsViewCache::Uncache(const uint256& hash)
+{
+    CCoinsMap::iterator it = cacheCoins.find(hash);
+    if (it != cacheCoins.end() && it->second.flags == 0) {
+        cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+        cacheCoins.erase(it);
+    }
+}
+
 bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  const uint256 &hashBlockIn,
                                  const uint256 &hashAnchorIn,
@@ -388,6 +397,7 @@ const CScript &CCoinsViewCache::GetSpendFor(const CTxIn& input) const
 
 //uint64_t safecoin_interest(int32_t txheight,uint64_t nValue,uint32_t nLockTime,uint32_t tiptime);
 uint64_t safecoin_accrued_interest(int32_t *txheightp,uint32_t *locktimep,uint256 hash,int32_t n,int32_t checkheight,uint64_t checkvalue);
+uint64_t safecoin_coins_interest(int32_t txheight,uint32_t locktime,uint64_t value);
 extern char ASSETCHAINS_SYMBOL[SAFECOIN_ASSETCHAIN_MAXLEN];
 
 CAmount CCoinsViewCache::GetValueIn(int32_t nHeight,int64_t *interestp,const CTransaction& tx,uint32_t tiptime) const
@@ -399,7 +409,9 @@ CAmount CCoinsViewCache::GetValueIn(int32_t nHeight,int64_t *interestp,const CTr
     CAmount value,nResult = 0;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        value = GetOutputFor(tx.vin[i]).nValue;
+        const CCoins* coins = AccessCoins(tx.vin[i].prevout.hash);
+        assert(coins && coins->IsAvailable(tx.vin[i].prevout.n));
+        value = coins->vout[tx.vin[i].prevout.n].nValue;
         nResult += value;
 #ifdef SAFECOIN_ENABLE_INTEREST
         if ( ASSETCHAINS_SYMBOL[0] == 0 && nHeight >= 60000 )
@@ -407,7 +419,11 @@ CAmount CCoinsViewCache::GetValueIn(int32_t nHeight,int64_t *interestp,const CTr
             if ( value >= 10*COIN )
             {
                 int64_t interest; int32_t txheight; uint32_t locktime;
-                interest = safecoin_accrued_interest(&txheight,&locktime,tx.vin[i].prevout.hash,tx.vin[i].prevout.n,0,value);
+                // entries carrying the lock time avoid loading the funding tx from disk; outputs of the
+                // block being connected are not in the tx index yet and must keep accruing nothing
+                if ( coins->fHaveLockTime != 0 && coins->nHeight <= nHeight )
+                    interest = safecoin_coins_interest(coins->nHeight,coins->nLockTime,value);
+                else interest = safecoin_accrued_interest(&txheight,&locktime,tx.vin[i].prevout.hash,tx.vin[i].prevout.n,0,value);
                 //printf("nResult %.8f += val %.8f interest %.8f ht.%d lock.%u tip.%u\n",(double)nResult/COIN,(double)value/COIN,(double)interest/COIN,txheight,locktime,tiptime);
                 //fprintf(stderr,"nResult %.8f += val %.8f interest %.8f ht.%d lock.%u tip.%u\n",(double)nResult/COIN,(double)value/COIN,(double)interest/COIN,txheight,locktime,tiptime);
                 nResult += interest;
@@ -72,6 +72,12 @@
  *              * 00: special txout type pay-to-pubkey-hash
  *              * 8c988f1a4a4de2161e0f50aac7f17e7f9555caa4: address uint160
  *  - height = 120891
+ *
+ * Entries written by newer nodes append VARINT(nLockTime) of the originating
+ * transaction after the height, so accrued interest can be computed from the
+ * coins view without loading the transaction. Older entries lack it and are
+ * read back with fHaveLockTime unset; spending from them keeps it unset, so
+ * they stay on the transaction lookup for as long as they exist.
  */
 class CCoins
 {
@@ -88,14 +94,18 @@ public:
     //! version of the CTransaction; accesses to this value should probably check for nHeight as well,
     //! as new tx version will probably only be introduced at certain heights
     int nVersion;
-    //uint32_t nLockTime;
+
+    //! nLockTime of the originating transaction, used for interest accrual; only meaningful if fHaveLockTime
+    uint32_t nLockTime;
+    bool fHaveLockTime;
 
     void FromTx(const CTransaction &tx, int nHeightIn) {
         fCoinBase = tx.IsCoinBase();
         vout = tx.vout;
         nHeight = nHeightIn;
         nVersion = tx.nVersion;
-        //nLockTime = tx.nLockTime;
+        nLockTime = tx.nLockTime;
+        fHaveLockTime = true;
         ClearUnspendable();
     }
 
@@ -109,10 +119,12 @@ public:
         std::vector<CTxOut>().swap(vout);
         nHeight = 0;
         nVersion = 0;
+        nLockTime = 0;
+        fHaveLockTime = false;
     }
 
     //! empty constructor
-    CCoins() : fCoinBase(false), vout(0), nHeight(0), nVersion(0) { }
+    CCoins() : fCoinBase(false), vout(0), nHeight(0), nVersion(0), nLockTime(0), fHaveLockTime(false) { }
 
     //!remove spent outputs at the end of vout
     void Cleanup() {
@@ -135,9 +147,11 @@ public:
         to.vout.swap(vout);
         std::swap(to.nHeight, nHeight);
         std::swap(to.nVersion, nVersion);
+        std::swap(to.nLockTime, nLockTime);
+        std::swap(to.fHaveLockTime, fHaveLockTime);
     }
 
-    //! equality test
+    //! equality test; the cached lock time is not part of the identity of an entry
     friend bool operator==(const CCoins &a, const CCoins &b) {
          // Empty CCoins objects are always equal.
          if (a.IsPruned() && b.IsPruned())
@@ -177,6 +191,9 @@ public:
                 nSize += ::GetSerializeSize(CTxOutCompressor(REF(vout[i])), nType, nVersion);
         // height
         nSize += ::GetSerializeSize(VARINT(nHeight), nType, nVersion);
+        // optional lock time
+        if (fHaveLockTime)
+            nSize += ::GetSerializeSize(VARINT(nLockTime), nType, nVersion);
         return nSize;
     }
 
@@ -207,6 +224,9 @@ public:
         }
         // coinbase height
         ::Serialize(s, VARINT(nHeight), nType, nVersion);
+        // optional lock time
+        if (fHaveLockTime)
+            ::Serialize(s, VARINT(nLockTime), nType, nVersion);
     }
 
     template<typename Stream>
@@ -240,6 +260,11 @@ public:
         }
         // coinbase height
         ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+        // optional lock time, absent in entries written by older versions
+        nLockTime = 0;
+        fHaveLockTime = !s.empty();
+        if (fHaveLockTime)
+            ::Unserialize(s, VARINT(nLockTime), nType, nVersion);
         Cleanup();
     }
 
@@ -493,6 +518,12 @@ public:
      */
     CCoinsModifier ModifyCoins(const uint256 &txid);
 
+    /**
+     * Removes the transaction with the given hash from the cache, if it is
+     * not modified.
+     */
+    void Uncache(const uint256 &txid);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
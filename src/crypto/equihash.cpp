@@ -17,6 +17,7 @@
 #endif
 
 #include "crypto/equihash.h"
+#include "crypto/common.h"
 #include "util.h"
 #ifndef __linux__
 #include "compat/endian.h"
@@ -82,6 +83,237 @@ void GenerateHash(const eh_HashState& base_state, eh_index g,
     crypto_generichash_blake2b_final(&state, hash, hLen);
 }
 
+/*
+ * Batched BLAKE2b.
+ *
+ * All Equihash hashes of one header are BLAKE2b(I||V||le32(g)) and share
+ * everything but the four index bytes. Once the common prefix is absorbed,
+ * each hash is a single compression of a final block that differs only in
+ * the message word holding g, so several indices can be hashed at once with
+ * one index per SIMD lane. The lane kernels are compiled for AVX2 (4 lanes)
+ * and AVX-512 (8 lanes) and picked at runtime; other CPUs, and states where
+ * the index does not fall on a 32-bit boundary of the final block, use
+ * libsodium one hash at a time.
+ *
+ * This reads the fields of libsodium's BLAKE2b state, which are public in
+ * the libsodium version pinned in depends.
+ */
+namespace {
+
+const uint64_t blake2b_IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+const uint8_t blake2b_sigma[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+// Works on both uint64_t and vectors of uint64_t
+#define B2B_ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define B2B_G(v, a, b, c, d, x, y) do {             \
+        v[a] = v[a] + v[b] + (x);                   \
+        v[d] = B2B_ROTR64(v[d] ^ v[a], 32);         \
+        v[c] = v[c] + v[d];                         \
+        v[b] = B2B_ROTR64(v[b] ^ v[c], 24);         \
+        v[a] = v[a] + v[b] + (y);                   \
+        v[d] = B2B_ROTR64(v[d] ^ v[a], 16);         \
+        v[c] = v[c] + v[d];                         \
+        v[b] = B2B_ROTR64(v[b] ^ v[c], 63);         \
+    } while (0)
+#define B2B_ROUND(v, m, s) do {                                 \
+        B2B_G(v, 0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);             \
+        B2B_G(v, 1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);             \
+        B2B_G(v, 2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);             \
+        B2B_G(v, 3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);             \
+        B2B_G(v, 0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);             \
+        B2B_G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);             \
+        B2B_G(v, 2, 7,  8, 13, m[s[12]], m[s[13]]);             \
+        B2B_G(v, 3, 4,  9, 14, m[s[14]], m[s[15]]);             \
+    } while (0)
+
+/** The final compression shared by all hashes of a batch. */
+struct FinalBlock
+{
+    uint64_t h[8];
+    uint64_t t[2];
+    uint64_t f[2];
+    uint64_t m[16];
+    unsigned int word;  //! message word holding the index
+    unsigned int shift; //! bit offset of the index within that word
+};
+
+void Compress(uint64_t h[8], const unsigned char* block, const uint64_t t[2], const uint64_t f[2])
+{
+    uint64_t m[16], v[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = ReadLE64(block + 8*i);
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i+8] = blake2b_IV[i];
+    }
+    v[12] ^= t[0];
+    v[13] ^= t[1];
+    v[14] ^= f[0];
+    v[15] ^= f[1];
+    for (int r = 0; r < 12; r++)
+        B2B_ROUND(v, m, blake2b_sigma[r]);
+    for (int i = 0; i < 8; i++)
+        h[i] ^= v[i] ^ v[i+8];
+}
+
+void IncrementCounter(uint64_t t[2], uint64_t inc)
+{
+    t[0] += inc;
+    t[1] += (t[0] < inc);
+}
+
+/**
+ * Absorbs base_state and a placeholder index into fb, following
+ * libsodium's update and final. Returns false if the index bytes would not
+ * all land in one 32-bit half of a message word of the final block.
+ */
+bool PrepareFinalBlock(const eh_HashState& base_state, FinalBlock& fb)
+{
+    const size_t BLOCKBYTES = 128;
+    size_t offset = base_state.buflen;
+    size_t len = offset + sizeof(eh_index);
+    if (len > 2 * BLOCKBYTES)
+        return false; // update() would compress
+    if (offset < BLOCKBYTES && len > BLOCKBYTES)
+        return false; // the index straddles two blocks
+    if (offset % 4 != 0)
+        return false;
+
+    memcpy(fb.h, base_state.h, sizeof(fb.h));
+    memcpy(fb.t, base_state.t, sizeof(fb.t));
+    unsigned char buf[2 * BLOCKBYTES] = {};
+    memcpy(buf, base_state.buf, offset);
+    const unsigned char* last = buf;
+    if (len > BLOCKBYTES) {
+        uint64_t f[2] = {0, 0};
+        IncrementCounter(fb.t, BLOCKBYTES);
+        Compress(fb.h, buf, fb.t, f);
+        last = buf + BLOCKBYTES;
+        offset -= BLOCKBYTES;
+        len -= BLOCKBYTES;
+    }
+    IncrementCounter(fb.t, len);
+    fb.f[0] = (uint64_t)-1;
+    fb.f[1] = base_state.last_node ? (uint64_t)-1 : 0;
+    for (int i = 0; i < 16; i++)
+        fb.m[i] = ReadLE64(last + 8*i);
+    fb.word = offset / 8;
+    fb.shift = (offset % 8) * 8;
+    return true;
+}
+
+/** Computes the hashes of W indices, one per lane of the vector type V. */
+template<typename V, size_t W>
+inline __attribute__((always_inline))
+void CompressLanes(const FinalBlock& fb, const eh_index* indices, unsigned char* out, size_t hLen)
+{
+    V m[16], v[16];
+    for (int i = 0; i < 16; i++)
+        for (size_t l = 0; l < W; l++)
+            m[i][l] = fb.m[i];
+    for (size_t l = 0; l < W; l++)
+        m[fb.word][l] = fb.m[fb.word] | ((uint64_t)indices[l] << fb.shift);
+    for (int i = 0; i < 8; i++) {
+        uint64_t iv = blake2b_IV[i];
+        if (i == 4) iv ^= fb.t[0];
+        if (i == 5) iv ^= fb.t[1];
+        if (i == 6) iv ^= fb.f[0];
+        if (i == 7) iv ^= fb.f[1];
+        for (size_t l = 0; l < W; l++) {
+            v[i][l] = fb.h[i];
+            v[i+8][l] = iv;
+        }
+    }
+    for (int r = 0; r < 12; r++)
+        B2B_ROUND(v, m, blake2b_sigma[r]);
+
+    unsigned char hash[64];
+    for (size_t l = 0; l < W; l++) {
+        for (int i = 0; i < 8; i++)
+            WriteLE64(hash + 8*i, fb.h[i] ^ v[i][l] ^ v[i+8][l]);
+        memcpy(out + l*hLen, hash, hLen);
+    }
+}
+
+typedef void (*CompressLanesFn)(const FinalBlock&, const eh_index*, unsigned char*, size_t);
+
+struct LanesKernel
+{
+    CompressLanesFn fn;
+    size_t lanes;
+};
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define EH_HAVE_SIMD_BLAKE2B 1
+typedef uint64_t eh_v4u64 __attribute__((vector_size(32)));
+typedef uint64_t eh_v8u64 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2")))
+void CompressLanesAVX2(const FinalBlock& fb, const eh_index* indices, unsigned char* out, size_t hLen)
+{
+    CompressLanes<eh_v4u64, 4>(fb, indices, out, hLen);
+}
+
+__attribute__((target("avx512f")))
+void CompressLanesAVX512(const FinalBlock& fb, const eh_index* indices, unsigned char* out, size_t hLen)
+{
+    CompressLanes<eh_v8u64, 8>(fb, indices, out, hLen);
+}
+#endif
+
+LanesKernel SelectLanesKernel()
+{
+    LanesKernel kernel = {NULL, 1};
+#ifdef EH_HAVE_SIMD_BLAKE2B
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernel.fn = CompressLanesAVX512;
+        kernel.lanes = 8;
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernel.fn = CompressLanesAVX2;
+        kernel.lanes = 4;
+    }
+#endif
+    return kernel;
+}
+
+}
+
+void GenerateHashes(const eh_HashState& base_state, const eh_index* indices, size_t count,
+                    unsigned char* hashes, size_t hLen)
+{
+    static const LanesKernel kernel = SelectLanesKernel();
+    assert(hLen <= 64);
+
+    size_t i = 0;
+    FinalBlock fb;
+    if (kernel.fn && count >= kernel.lanes && PrepareFinalBlock(base_state, fb)) {
+        for (; i + kernel.lanes <= count; i += kernel.lanes)
+            kernel.fn(fb, indices + i, hashes + i*hLen, hLen);
+    }
+    for (; i < count; i++)
+        GenerateHash(base_state, indices[i], hashes + i*hLen, hLen);
+}
+
 void ExpandArray(const unsigned char* in, size_t in_len,
                  unsigned char* out, size_t out_len,
                  size_t bit_len, size_t byte_pad)
@@ -365,12 +597,18 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
     size_t lenIndices = sizeof(eh_index);
     std::vector<FullStepRow<FullWidth>> X;
     X.reserve(init_size);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index g = 0; X.size() < init_size; g++) {
-        GenerateHash(base_state, g, tmpHash, HashOutput);
-        for (eh_index i = 0; i < IndicesPerHashOutput && X.size() < init_size; i++) {
-            X.emplace_back(tmpHash+(i*N/8), N/8, HashLength,
-                           CollisionBitLength, (g*IndicesPerHashOutput)+i);
+    eh_index gBatch[EH_HASH_BATCH];
+    unsigned char tmpHashes[EH_HASH_BATCH*HashOutput];
+    for (eh_index g0 = 0; X.size() < init_size; g0 += EH_HASH_BATCH) {
+        for (eh_index j = 0; j < EH_HASH_BATCH; j++)
+            gBatch[j] = g0 + j;
+        GenerateHashes(base_state, gBatch, EH_HASH_BATCH, tmpHashes, HashOutput);
+        for (eh_index j = 0; j < EH_HASH_BATCH && X.size() < init_size; j++) {
+            const unsigned char* tmpHash = tmpHashes + j*HashOutput;
+            for (eh_index i = 0; i < IndicesPerHashOutput && X.size() < init_size; i++) {
+                X.emplace_back(tmpHash+(i*N/8), N/8, HashLength,
+                               CollisionBitLength, ((g0+j)*IndicesPerHashOutput)+i);
+            }
         }
         if (cancelled(ListGeneration)) throw solver_cancelled;
     }
@@ -544,12 +782,18 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         size_t lenIndices = sizeof(eh_trunc);
         std::vector<TruncatedStepRow<TruncatedWidth>> Xt;
         Xt.reserve(init_size);
-        unsigned char tmpHash[HashOutput];
-        for (eh_index g = 0; Xt.size() < init_size; g++) {
-            GenerateHash(base_state, g, tmpHash, HashOutput);
-            for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
-                Xt.emplace_back(tmpHash+(i*N/8), N/8, HashLength, CollisionBitLength,
-                                (g*IndicesPerHashOutput)+i, CollisionBitLength + 1);
+        eh_index gBatch[EH_HASH_BATCH];
+        unsigned char tmpHashes[EH_HASH_BATCH*HashOutput];
+        for (eh_index g0 = 0; Xt.size() < init_size; g0 += EH_HASH_BATCH) {
+            for (eh_index j = 0; j < EH_HASH_BATCH; j++)
+                gBatch[j] = g0 + j;
+            GenerateHashes(base_state, gBatch, EH_HASH_BATCH, tmpHashes, HashOutput);
+            for (eh_index j = 0; j < EH_HASH_BATCH && Xt.size() < init_size; j++) {
+                const unsigned char* pHash = tmpHashes + j*HashOutput;
+                for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
+                    Xt.emplace_back(pHash+(i*N/8), N/8, HashLength, CollisionBitLength,
+                                    ((g0+j)*IndicesPerHashOutput)+i, CollisionBitLength + 1);
+                }
             }
             if (cancelled(ListGeneration)) throw solver_cancelled;
         }
@@ -755,12 +999,18 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
+    std::vector<eh_index> indices(GetIndicesFromMinimal(soln, CollisionBitLength));
+    std::vector<eh_index> hashIndices(indices.size());
+    for (size_t j = 0; j < indices.size(); j++)
+        hashIndices[j] = indices[j]/IndicesPerHashOutput;
+    std::vector<unsigned char> hashes(indices.size()*HashOutput);
+    GenerateHashes(base_state, hashIndices.data(), hashIndices.size(), hashes.data(), HashOutput);
+
     std::vector<FullStepRow<FinalFullWidth>> X;
     X.reserve(1 << K);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
+    for (size_t j = 0; j < indices.size(); j++) {
+        eh_index i = indices[j];
+        X.emplace_back(&hashes[j*HashOutput]+((i % IndicesPerHashOutput) * N/8),
                        N/8, HashLength, CollisionBitLength, i);
     }
 
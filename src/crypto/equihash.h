@@ -24,6 +24,17 @@ typedef crypto_generichash_blake2b_state eh_HashState;
 typedef uint32_t eh_index;
 typedef uint8_t eh_trunc;
 
+/** Number of hashes generated per GenerateHashes call when filling the initial lists */
+static const unsigned int EH_HASH_BATCH = 64;
+
+/**
+ * Computes BLAKE2b(base_state || le32(indices[i])) for each of the count
+ * indices, writing hLen bytes per hash to hashes. Uses SIMD lanes where the
+ * CPU supports it.
+ */
+void GenerateHashes(const eh_HashState& base_state, const eh_index* indices, size_t count,
+                    unsigned char* hashes, size_t hLen);
+
 void ExpandArray(const unsigned char* in, size_t in_len,
                  unsigned char* out, size_t out_len,
                  size_t bit_len, size_t byte_pad=0);
@@ -5,6 +5,7 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include "crypto/common.h"
 #include "crypto/equihash.h"
 #include "uint256.h"
 
@@ -80,6 +81,47 @@ TEST(equihash_tests, is_probably_duplicate) {
     ASSERT_TRUE(IsProbablyDuplicate<4>(p3, 4));
 }
 
+void TestGenerateHashes(const std::string &scope, Equihash<200,9> &eh, size_t prefix_len)
+{
+    SCOPED_TRACE(scope);
+
+    eh_HashState state;
+    eh.InitialiseState(state);
+    std::vector<unsigned char> prefix(prefix_len);
+    for (size_t i = 0; i < prefix_len; i++)
+        prefix[i] = (unsigned char)(i * 7 + 3);
+    crypto_generichash_blake2b_update(&state, prefix.data(), prefix.size());
+
+    // An odd count exercises both the SIMD lanes and the scalar tail
+    const size_t count = 37;
+    const size_t hLen = 50;
+    std::vector<eh_index> indices(count);
+    for (size_t i = 0; i < count; i++)
+        indices[i] = i * 1000 + 5;
+    std::vector<unsigned char> hashes(count * hLen);
+    GenerateHashes(state, indices.data(), count, hashes.data(), hLen);
+
+    for (size_t i = 0; i < count; i++) {
+        eh_HashState s = state;
+        unsigned char leb[4];
+        WriteLE32(leb, indices[i]);
+        crypto_generichash_blake2b_update(&s, leb, sizeof(leb));
+        std::vector<unsigned char> expected(hLen);
+        crypto_generichash_blake2b_final(&s, expected.data(), hLen);
+        EXPECT_EQ(expected, std::vector<unsigned char>(hashes.begin() + i * hLen,
+                                                       hashes.begin() + (i + 1) * hLen));
+    }
+}
+
+TEST(equihash_tests, generate_hashes_matches_blake2b) {
+    Equihash<200,9> Eh200_9;
+    TestGenerateHashes("block header", Eh200_9, 140);
+    TestGenerateHashes("index in first block", Eh200_9, 108);
+    TestGenerateHashes("index at end of first block", Eh200_9, 124);
+    TestGenerateHashes("unaligned index", Eh200_9, 126);
+    TestGenerateHashes("full buffer", Eh200_9, 250);
+}
+
 #ifdef ENABLE_MINING
 TEST(equihash_tests, check_basic_solver_cancelled) {
     Equihash<48,5> Eh48_5;
@@ -83,6 +83,25 @@ void test_full_api(ZCJoinSplit* js)
         rt
     ));
 
+    // A batch accepts the valid proof, and rejects it next to an invalid one
+    {
+        auto batchVerifier = libzcash::ProofVerifier::Batch();
+        ASSERT_TRUE(js->verify(proof, batchVerifier, pubKeyHash, randomSeed,
+                               macs, nullifiers, commitments, vpub_old, vpub_new, rt));
+        ASSERT_TRUE(js->verify(proof, batchVerifier, pubKeyHash, randomSeed,
+                               macs, nullifiers, commitments, vpub_old, vpub_new, rt));
+        ASSERT_TRUE(batchVerifier.VerifyBatch());
+
+        ASSERT_TRUE(js->verify(proof, batchVerifier, pubKeyHash, randomSeed,
+                               macs, nullifiers, commitments, vpub_old, vpub_new, rt));
+        ASSERT_TRUE(js->verify(ZCProof::random_invalid(), batchVerifier, pubKeyHash, randomSeed,
+                               macs, nullifiers, commitments, vpub_old, vpub_new, rt));
+        ASSERT_FALSE(batchVerifier.VerifyBatch());
+
+        // The batch is cleared after each verification
+        ASSERT_TRUE(batchVerifier.VerifyBatch());
+    }
+
     // Recipient should decrypt
     // Now the recipient should spend the money again
     auto h_sig = js->h_sig(randomSeed, nullifiers, pubKeyHash);
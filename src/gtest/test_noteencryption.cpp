@@ -104,6 +104,46 @@ TEST(noteencryption, api)
     }
 }
 
+TEST(noteencryption, try_decrypt)
+{
+    uint256 sk_enc = ZCNoteEncryption::generate_privkey(uint252(uint256S("21035d60bc1983e37950ce4803418a8fb33ea68d5b937ca382ecbae7564d6a07")));
+    uint256 pk_enc = ZCNoteEncryption::generate_pubkey(sk_enc);
+    uint256 sk_enc_2 = ZCNoteEncryption::generate_privkey(uint252());
+    uint256 pk_enc_2 = ZCNoteEncryption::generate_pubkey(sk_enc_2);
+    uint256 hSig = uint256S("11035d60bc1983e37950ce4803418a8fb33ea68d5b937ca382ecbae7564d6a77");
+
+    boost::array<unsigned char, ZC_NOTEPLAINTEXT_SIZE> message;
+    for (size_t i = 0; i < ZC_NOTEPLAINTEXT_SIZE; i++) {
+        message[i] = (unsigned char) i;
+    }
+
+    // Like a JoinSplit, with the second output to another key
+    ZCNoteEncryption b = ZCNoteEncryption(hSig);
+    boost::array<ZCNoteEncryption::Ciphertext, 2> ciphertexts;
+    ciphertexts[0] = b.encrypt(pk_enc, message);
+    ciphertexts[1] = b.encrypt(pk_enc_2, message);
+
+    ZCNoteDecryption decrypter(sk_enc);
+    auto plaintexts = decrypter.try_decrypt(ciphertexts.data(), 2, b.get_epk(), hSig);
+    ASSERT_EQ(2, plaintexts.size());
+    ASSERT_TRUE(plaintexts[0]);
+    EXPECT_TRUE(*plaintexts[0] == message);
+    EXPECT_FALSE(plaintexts[1]);
+
+    ZCNoteDecryption decrypter2(sk_enc_2);
+    plaintexts = decrypter2.try_decrypt(ciphertexts.data(), 2, b.get_epk(), hSig);
+    EXPECT_FALSE(plaintexts[0]);
+    ASSERT_TRUE(plaintexts[1]);
+    EXPECT_TRUE(*plaintexts[1] == message);
+
+    // Wrong hSig and corrupted ciphertexts fail without throwing
+    plaintexts = decrypter.try_decrypt(ciphertexts.data(), 2, b.get_epk(), uint256());
+    EXPECT_FALSE(plaintexts[0]);
+    ciphertexts[0][10] ^= 0xff;
+    plaintexts = decrypter.try_decrypt(ciphertexts.data(), 2, b.get_epk(), hSig);
+    EXPECT_FALSE(plaintexts[0]);
+}
+
 uint256 test_prf(
     unsigned char distinguisher,
     uint252 seed_x,
@@ -33,8 +33,8 @@
 
 #include "sodium.h"
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
@@ -49,51 +49,89 @@ using namespace std;
 
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. The mempool tracks these links and the
+// fee rate of every transaction together with its in-pool ancestors, so
+// CreateNewBlock walks its ancestor-score index and adds each transaction
+// together with whichever of its ancestors are not yet in the block.
 //
-class COrphan
+
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
+// The priority area is still filled by coin-age priority, which changes with
+// the height and so is not indexed by the mempool:
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+class TxCoinAgePriorityCompare
+{
+public:
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b)
+    {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByScore()(*(b.second), *(a.second)); //Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
+
+/**
+ * The transactions selected for the last block template, kept between calls
+ * on the same tip. Later calls only check mempool transactions that were not
+ * considered before and append them; the coinbase, time and header are
+ * rebuilt each time. The cache is thrown away when the tip changes, or when
+ * one of its transactions leaves the mempool or stops validating at the new
+ * block time. Guarded by cs_main.
+ */
+class CBlockTemplateCache
 {
 public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    uint256 hashPrevBlock;
+    boost::scoped_ptr<CCoinsViewCache> pview; //! pcoinsTip with the selected transactions applied
+    std::vector<CTransaction> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    std::set<uint256> setInBlock;
+    std::set<uint256> setFailed; //! can't go in a block on this tip, whatever its time
+    uint64_t nBlockSize;
+    int nBlockSigOps;
+    CAmount nFees;
+    bool fSortedByFee;
+    bool fValidated; //! TestBlockValidity passed with these transactions...
+    std::vector<CTxOut> vCoinbaseOutValidated; //! ... and this coinbase
+
+    void Reset(CBlockIndex* pindexPrev, bool fSortedByFeeIn)
+    {
+        hashPrevBlock = pindexPrev->GetBlockHash();
+        pview.reset(new CCoinsViewCache(pcoinsTip));
+        vtx.clear();
+        vTxFees.clear();
+        vTxSigOps.clear();
+        setInBlock.clear();
+        setFailed.clear();
+        nBlockSize = 1000;
+        nBlockSigOps = 100;
+        nFees = 0;
+        fSortedByFee = fSortedByFeeIn;
+        fValidated = false;
+        vCoinbaseOutValidated.clear();
+    }
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    void Invalidate()
     {
+        hashPrevBlock.SetNull();
+        pview.reset();
     }
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
+static CBlockTemplateCache blockTemplateCache;
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+// Orders the members of a package so that parents come before their children
+class CompareTxIterByAncestorCount
 {
-    bool byFee;
-
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
     {
-        if (byFee)
-        {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
     }
 };
 
@@ -182,208 +220,248 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
     nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
 
     // Collect memory pool transactions into the block
-    CAmount nFees = 0;
-
     {
         LOCK2(cs_main, mempool.cs);
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
         pblock->nTime = GetAdjustedTime();
         const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-        CCoinsViewCache view(pcoinsTip);
-        uint32_t expired;
+        int64_t nTimeStart = GetTimeMicros();
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
         bool fPrintPriority = GetBoolArg("-printpriority", false);
+        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                ? nMedianTimePast
+                                : pblock->GetBlockTime();
+
+        // Reuse the transactions picked for the last template on this tip,
+        // unless one of them has since left the mempool or would now fail the
+        // interest locktime check.
+        CBlockTemplateCache& cache = blockTemplateCache;
+        bool fRebuild = (!cache.pview || cache.hashPrevBlock != pindexPrev->GetBlockHash());
+        for (unsigned int i = 0; !fRebuild && i < cache.vtx.size(); i++)
+        {
+            if (!mempool.exists(cache.vtx[i].GetHash()) ||
+                safecoin_validate_interest(cache.vtx[i],nHeight,(uint32_t)pblock->nTime,2) < 0)
+                fRebuild = true;
+        }
+        if (fRebuild)
+            cache.Reset(pindexPrev, nBlockPrioritySize <= 0);
+
+        CCoinsViewCache& view = *cache.pview;
+        uint64_t& nBlockSize = cache.nBlockSize;
+        int& nBlockSigOps = cache.nBlockSigOps;
+        CAmount& nFees = cache.nFees;
+        bool& fSortedByFee = cache.fSortedByFee;
+        uint64_t nBlockTx = cache.vtx.size();
+        unsigned int nNewTx = 0;
+        int64_t interest;
+
+        CTxMemPool::setEntries failedTx; // can't go in this block, and neither can their descendants
 
         // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
+        vector<TxCoinAgePriority> vecPriority;
+        TxCoinAgePriorityCompare pricomparer;
+        if (!fSortedByFee && fRebuild)
         {
-            const CTransaction& tx = mi->second.GetTx();
+            vecPriority.reserve(mempool.mapTx.size());
+            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+                 mi != mempool.mapTx.end(); ++mi)
+            {
+                double dPriority = mi->GetPriority(nHeight);
+                CAmount dummy;
+                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+                vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+            }
+            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        }
 
-            int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                    ? nMedianTimePast
-                                    : pblock->GetBlockTime();
+        CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+        CTxMemPool::txiter iter;
+
+        while (true)
+        {
+            double dPriority = 0;
+            if (!fSortedByFee && !vecPriority.empty())
+            {
+                // Take highest priority transaction off the priority queue:
+                dPriority = vecPriority.front().first;
+                iter = vecPriority.front().second;
+                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                vecPriority.pop_back();
+            }
+            else if (mi != mempool.mapTx.get<ancestor_score>().end())
+            {
+                // Take the package with the next highest fee rate
+                iter = mempool.mapTx.project<0>(mi);
+                mi++;
+            }
+            else
+                break;
 
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff))
+            if (cache.setInBlock.count(iter->GetTx().GetHash()) || failedTx.count(iter))
                 continue;
-            if ( safecoin_validate_interest(tx,nHeight,(uint32_t)pblock->nTime,2) < 0 )
+            if (cache.setFailed.count(iter->GetTx().GetHash()))
             {
-                fprintf(stderr,"CreateNewBlock: safecoin_validate_interest failure\n");
+                failedTx.insert(iter);
                 continue;
             }
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+
+            // The in-mempool ancestors not yet in the block have to go in first
+            CTxMemPool::setEntries setAncestors;
+            mempool.CalculateMemPoolAncestors(iter, setAncestors);
+            vector<CTxMemPool::txiter> vPackage;
+            bool fFailedAncestor = false;
+            BOOST_FOREACH(CTxMemPool::txiter ancestorIt, setAncestors)
             {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
+                if (failedTx.count(ancestorIt))
                 {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
+                    fFailedAncestor = true;
+                    break;
                 }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
+                if (!cache.setInBlock.count(ancestorIt->GetTx().GetHash()))
+                    vPackage.push_back(ancestorIt);
             }
-            nTotalIn += tx.GetJoinSplitValueIn();
-
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
-
-            if (porphan)
+            if (fFailedAncestor)
             {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
+                failedTx.insert(iter);
+                continue;
             }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int64_t interest;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+            vPackage.push_back(iter);
+            std::sort(vPackage.begin(), vPackage.end(), CompareTxIterByAncestorCount());
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+            unsigned int nPackageSize = 0;
+            unsigned int nPackageSigOps = 0;
+            CAmount nPackageFees = 0;
+            BOOST_FOREACH(CTxMemPool::txiter packageIt, vPackage)
+            {
+                nPackageSize += packageIt->GetTxSize();
+                nPackageSigOps += GetLegacySigOpCount(packageIt->GetTx());
+                nPackageFees += packageIt->GetModifiedFee();
+            }
 
             // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
+            if (nBlockSize + nPackageSize >= nBlockMaxSize)
                 continue;
 
             // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            if (nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS)
                 continue;
 
             // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
+            CFeeRate feeRate(nPackageFees, nPackageSize);
             double dPriorityDelta = 0;
             CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
+            mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriorityDelta, nFeeDelta);
+            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nPackageSize >= nBlockMinSize))
                 continue;
 
             // Prioritise by fee once past the priority size or we run out of high-priority
             // transactions:
             if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
+                ((nBlockSize + nPackageSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
             {
                 fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
             }
 
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(chainActive.Tip()->nHeight,&interest,tx,chainActive.Tip()->nTime)-tx.GetValueOut();
+            // Check the whole package against a scratch view first, so that a
+            // member failing part way leaves none of the package in the block
+            CCoinsViewCache viewPackage(&view);
+            vector<CAmount> vPackageTxFees;
+            vector<int64_t> vPackageTxSigOps;
+            int nPackageBlockSigOps = 0;
+            bool fPackageValid = true;
+            BOOST_FOREACH(CTxMemPool::txiter packageIt, vPackage)
+            {
+                const CTransaction& tx = packageIt->GetTx();
+                nNewTx++;
+                fPackageValid = false;
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+                if (tx.IsCoinBase())
+                {
+                    failedTx.insert(packageIt);
+                    cache.setFailed.insert(tx.GetHash());
+                    break;
+                }
+                // These two depend on the block time, so a later call may
+                // accept what this one refuses; keep them out of setFailed
+                if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
+                {
+                    failedTx.insert(packageIt);
+                    break;
+                }
+                if ( safecoin_validate_interest(tx,nHeight,(uint32_t)pblock->nTime,2) < 0 )
+                {
+                    fprintf(stderr,"CreateNewBlock: safecoin_validate_interest failure\n");
+                    failedTx.insert(packageIt);
+                    break;
+                }
+                if (!viewPackage.HaveInputs(tx))
+                {
+                    failedTx.insert(packageIt);
+                    cache.setFailed.insert(tx.GetHash());
+                    break;
+                }
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, Params().GetConsensus()))
-                continue;
+                CAmount nTxFees = viewPackage.GetValueIn(chainActive.Tip()->nHeight,&interest,tx,chainActive.Tip()->nTime)-tx.GetValueOut();
 
-            UpdateCoins(tx, state, view, nHeight);
+                unsigned int nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, viewPackage);
+                if (nBlockSigOps + nPackageBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+                    break;
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+                // Note that flags: we don't want to set mempool/IsStandard()
+                // policy here, but we still have to ensure that the block we
+                // create only contains transactions that are valid in new blocks.
+                CValidationState state;
+                if (!ContextualCheckInputs(tx, state, viewPackage, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, Params().GetConsensus()))
+                {
+                    failedTx.insert(packageIt);
+                    cache.setFailed.insert(tx.GetHash());
+                    break;
+                }
 
-            if (fPrintPriority)
-            {
-                LogPrintf("priority %.1f fee %s txid %s\n",dPriority, feeRate.ToString(), tx.GetHash().ToString());
+                UpdateCoins(tx, state, viewPackage, nHeight);
+                vPackageTxFees.push_back(nTxFees);
+                vPackageTxSigOps.push_back(nTxSigOps);
+                nPackageBlockSigOps += nTxSigOps;
+                fPackageValid = true;
             }
+            if (!fPackageValid)
+                continue;
+            viewPackage.Flush();
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
+            for (unsigned int i = 0; i < vPackage.size(); i++)
             {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
+                CTxMemPool::txiter packageIt = vPackage[i];
+                const CTransaction& tx = packageIt->GetTx();
+
+                // Added
+                cache.vtx.push_back(tx);
+                cache.vTxFees.push_back(vPackageTxFees[i]);
+                cache.vTxSigOps.push_back(vPackageTxSigOps[i]);
+                cache.setInBlock.insert(tx.GetHash());
+                cache.fValidated = false;
+                nBlockSize += packageIt->GetTxSize();
+                ++nBlockTx;
+                nBlockSigOps += vPackageTxSigOps[i];
+                nFees += vPackageTxFees[i];
+
+                if (fPrintPriority)
                 {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
+                    LogPrintf("priority %.1f fee %s txid %s\n",
+                              packageIt->GetPriority(nHeight), CFeeRate(packageIt->GetModifiedFee(), packageIt->GetTxSize()).ToString(), tx.GetHash().ToString());
                 }
             }
         }
 
+        pblock->vtx.insert(pblock->vtx.end(), cache.vtx.begin(), cache.vtx.end());
+        pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), cache.vTxFees.begin(), cache.vTxFees.end());
+        pblocktemplate->vTxSigOps.insert(pblocktemplate->vTxSigOps.end(), cache.vTxSigOps.begin(), cache.vTxSigOps.end());
+
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
         LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+        LogPrint("bench", "    - CreateNewBlock: %s template, %u txs checked: %.2fms\n",
+                 fRebuild ? "new" : "cached", nNewTx, (GetTimeMicros() - nTimeStart) * 0.001);
 
         // Create coinbase tx
         CMutableTransaction txNew;
@@ -437,13 +515,23 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         pblock->nSolution.clear();
         pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
-        CValidationState state;
-        if ( !TestBlockValidity(state, *pblock, pindexPrev, false, false))
+        // Only the coinbase and header changed if the transactions were
+        // validated before; the coinbase output script is irrelevant here.
+        vector<CTxOut> vCoinbaseOut(pblock->vtx[0].vout);
+        vCoinbaseOut[0].scriptPubKey = CScript();
+        if (!cache.fValidated || vCoinbaseOut != cache.vCoinbaseOutValidated)
         {
-            static uint32_t counter;
-            if ( counter++ < 100 )
-                fprintf(stderr,"warning: testblockvalidity failed\n");
-            return(0);
+            CValidationState state;
+            if ( !TestBlockValidity(state, *pblock, pindexPrev, false, false))
+            {
+                static uint32_t counter;
+                if ( counter++ < 100 )
+                    fprintf(stderr,"warning: testblockvalidity failed\n");
+                cache.Invalidate();
+                return(0);
+            }
+            cache.fValidated = true;
+            cache.vCoinbaseOutValidated = vCoinbaseOut;
         }
     }
 
@@ -656,6 +744,26 @@ void static BitcoinMiner()
     //else solver = "default";
     assert(solver == "tromp" || solver == "default");
     LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
+
+    // The tromp solver's buckets are allocated once per miner thread, and
+    // -equihashsolverthreads threads cooperate on each nonce using them.
+    int nSolverThreads = GetArg("-equihashsolverthreads", 1);
+    if (nSolverThreads < 1)
+        nSolverThreads = 1;
+#ifndef EQUIHASH_TROMP_ATOMIC
+    // without atomic bucket counters the threads would race on them
+    if (nSolverThreads > 1)
+    {
+        LogPrintf("-equihashsolverthreads needs a build with EQUIHASH_TROMP_ATOMIC, using 1\n");
+        nSolverThreads = 1;
+    }
+#endif
+    std::unique_ptr<equi> eq;
+    if (solver == "tromp")
+    {
+        eq.reset(new equi(nSolverThreads));
+        LogPrint("pow", "Equihash solver using %d threads per nonce\n", nSolverThreads);
+    }
     if ( ASSETCHAINS_SYMBOL[0] != 0 )
         fprintf(stderr,"notaryid.%d Mining.%s with %s\n",notaryid,ASSETCHAINS_SYMBOL,solver.c_str());
     std::mutex m_cs;
@@ -906,28 +1014,19 @@ void static BitcoinMiner()
 
                 // TODO: factor this out into a function with the same API for each solver.
                 if (solver == "tromp" ) { //&& notaryid >= 0 ) {
-                    // Create solver and initialize it.
-                    equi eq(1);
-                    eq.setstate(&curr_state);
+                    // Initialize the solver with this nonce.
+                    eq->setstate(&curr_state);
 
                     // Intialization done, start algo driver.
-                    eq.digit0(0);
-                    eq.xfull = eq.bfull = eq.hfull = 0;
-                    eq.showbsizes(0);
-                    for (u32 r = 1; r < WK; r++) {
-                        (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-                        eq.xfull = eq.bfull = eq.hfull = 0;
-                        eq.showbsizes(r);
-                    }
-                    eq.digitK(0);
+                    u32 nsols = solve(eq.get());
                     ehSolverRuns.increment();
 
                     // Convert solution indices to byte array (decompress) and pass it to validBlock method.
-                    for (size_t s = 0; s < eq.nsols; s++) {
+                    for (size_t s = 0; s < nsols; s++) {
                         LogPrint("pow", "Checking solution %d\n", s+1);
                         std::vector<eh_index> index_vector(PROOFSIZE);
                         for (size_t i = 0; i < PROOFSIZE; i++) {
-                            index_vector[i] = eq.sols[s][i];
+                            index_vector[i] = eq->sols[s][i];
                         }
                         std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
 
@@ -19,6 +19,7 @@
 // twice the number of subtrees expected to land there.
 
 #include "pow/tromp/equi.h"
+#include "crypto/equihash.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -145,12 +146,12 @@ typedef bucket0 digit0[NBUCKETS];
 typedef bucket1 digit1[NBUCKETS];
 
 // size (in bytes) of hash in round 0 <= r < WK
-u32 hashsize(const u32 r) {
+inline u32 hashsize(const u32 r) {
   const u32 hashbits = WN - (r+1) * DIGITBITS + RESTBITS;
   return (hashbits + 7) / 8;
 }
 
-u32 hashwords(u32 bytes) {
+inline u32 hashwords(u32 bytes) {
   return (bytes + 3) / 4;
 }
 
@@ -199,7 +200,7 @@ struct htalloc {
 
 typedef au32 bsizes[NBUCKETS];
 
-u32 min(const u32 a, const u32 b) {
+inline u32 min(const u32 a, const u32 b) {
   return a < b ? a : b;
 }
 
@@ -430,39 +431,43 @@ struct equi {
   };
 
   void digit0(const u32 id) {
-    uchar hash[HASHOUT];
-    crypto_generichash_blake2b_state state;
+    u32 blocks[EH_HASH_BATCH];
+    uchar hashes[EH_HASH_BATCH * HASHOUT];
     htlayout htl(this, 0);
     const u32 hashbytes = hashsize(0);
-    for (u32 block = id; block < NBLOCKS; block += nthreads) {
-      state = blake_ctx;
-      u32 leb = htole32(block);
-      crypto_generichash_blake2b_update(&state, (uchar *)&leb, sizeof(u32));
-      crypto_generichash_blake2b_final(&state, hash, HASHOUT);
-      for (u32 i = 0; i<HASHESPERBLAKE; i++) {
-        const uchar *ph = hash + i * WN/8;
+    for (u32 first = id; first < NBLOCKS; first += EH_HASH_BATCH * nthreads) {
+      u32 nblocks = 0;
+      for (u32 block = first; block < NBLOCKS && nblocks < EH_HASH_BATCH; block += nthreads)
+        blocks[nblocks++] = block;
+      GenerateHashes(blake_ctx, blocks, nblocks, hashes, HASHOUT);
+      for (u32 b = 0; b < nblocks; b++) {
+        const u32 block = blocks[b];
+        const uchar *hash = hashes + b * HASHOUT;
+        for (u32 i = 0; i<HASHESPERBLAKE; i++) {
+          const uchar *ph = hash + i * WN/8;
 #if BUCKBITS == 16 && RESTBITS == 4
-        const u32 bucketid = ((u32)ph[0] << 8) | ph[1];
+          const u32 bucketid = ((u32)ph[0] << 8) | ph[1];
 #elif BUCKBITS == 12 && RESTBITS == 8
-        const u32 bucketid = ((u32)ph[0] << 4) | ph[1] >> 4;
+          const u32 bucketid = ((u32)ph[0] << 4) | ph[1] >> 4;
 #elif BUCKBITS == 11 && RESTBITS == 9
-        const u32 bucketid = ((u32)ph[0] << 3) | ph[1] >> 5;
+          const u32 bucketid = ((u32)ph[0] << 3) | ph[1] >> 5;
 #elif BUCKBITS == 20 && RESTBITS == 4
-        const u32 bucketid = ((((u32)ph[0] << 8) | ph[1]) << 4) | ph[2] >> 4;
+          const u32 bucketid = ((((u32)ph[0] << 8) | ph[1]) << 4) | ph[2] >> 4;
 #elif BUCKBITS == 12 && RESTBITS == 4
-        const u32 bucketid = ((u32)ph[0] << 4) | ph[1] >> 4;
-        const u32 xhash = ph[1] & 0xf;
+          const u32 bucketid = ((u32)ph[0] << 4) | ph[1] >> 4;
+          const u32 xhash = ph[1] & 0xf;
 #else
 #error not implemented
 #endif
-        const u32 slot = getslot(0, bucketid);
-        if (slot >= NSLOTS) {
-          bfull++;
-          continue;
+          const u32 slot = getslot(0, bucketid);
+          if (slot >= NSLOTS) {
+            bfull++;
+            continue;
+          }
+          slot0 &s = hta.trees0[0][bucketid][slot];
+          s.attr = tree(block * HASHESPERBLAKE + i);
+          memcpy(s.hash->bytes+htl.nextbo, ph+WN/8-hashbytes, hashbytes);
         }
-        slot0 &s = hta.trees0[0][bucketid][slot];
-        s.attr = tree(block * HASHESPERBLAKE + i);
-        memcpy(s.hash->bytes+htl.nextbo, ph+WN/8-hashbytes, hashbytes);
       }
     }
   }
@@ -600,7 +605,7 @@ typedef struct {
   equi *eq;
 } thread_ctx;
 
-void barrier(pthread_barrier_t *barry) {
+inline void barrier(pthread_barrier_t *barry) {
   const int rc = pthread_barrier_wait(barry);
   if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD) {
 //    printf("Could not wait on barrier\n");
@@ -608,12 +613,12 @@ void barrier(pthread_barrier_t *barry) {
   }
 }
 
-void *worker(void *vp) {
+inline void *worker(void *vp) {
   thread_ctx *tp = (thread_ctx *)vp;
   equi *eq = tp->eq;
 
-  if (tp->id == 0)
-//    printf("Digit 0\n");
+  // every thread must reach every barrier, so progress reporting
+  // by thread 0 may not guard the barrier calls
   barrier(&eq->barry);
   eq->digit0(tp->id);
   barrier(&eq->barry);
@@ -623,8 +628,6 @@ void *worker(void *vp) {
   }
   barrier(&eq->barry);
   for (u32 r = 1; r < WK; r++) {
-    if (tp->id == 0)
-//      printf("Digit %d", r);
     barrier(&eq->barry);
     r&1 ? eq->digitodd(r, tp->id) : eq->digiteven(r, tp->id);
     barrier(&eq->barry);
@@ -635,10 +638,37 @@ void *worker(void *vp) {
     }
     barrier(&eq->barry);
   }
-  if (tp->id == 0)
-//    printf("Digit %d\n", WK);
   eq->digitK(tp->id);
   barrier(&eq->barry);
   pthread_exit(NULL);
   return 0;
 }
+
+// run all rounds for the state set on eq, with eq->nthreads threads
+// sharing its buckets; returns the number of solutions found
+inline u32 solve(equi *eq) {
+  if (eq->nthreads == 1) {
+    eq->digit0(0);
+    eq->xfull = eq->bfull = eq->hfull = 0;
+    eq->showbsizes(0);
+    for (u32 r = 1; r < WK; r++) {
+      (r&1) ? eq->digitodd(r, 0) : eq->digiteven(r, 0);
+      eq->xfull = eq->bfull = eq->hfull = 0;
+      eq->showbsizes(r);
+    }
+    eq->digitK(0);
+    return min(eq->nsols, MAXSOLS);
+  }
+  thread_ctx *threads = (thread_ctx *)calloc(eq->nthreads, sizeof(thread_ctx));
+  assert(threads);
+  for (u32 t = 0; t < eq->nthreads; t++) {
+    threads[t].id = t;
+    threads[t].eq = eq;
+    const int err = pthread_create(&threads[t].thread, NULL, worker, (void *)&threads[t]);
+    assert(err == 0);
+  }
+  for (u32 t = 0; t < eq->nthreads; t++)
+    pthread_join(threads[t].thread, NULL);
+  free(threads);
+  return min(eq->nsols, MAXSOLS);
+}
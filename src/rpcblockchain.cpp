@@ -200,10 +200,9 @@ UniValue mempoolToJSON(bool fVerbose = false)
     {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
         {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -309,6 +308,37 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
     return pblockindex->GetBlockHash().GetHex();
 }
 
+UniValue getblockhashes(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getblockhashes high low\n"
+            "\nReturns array of hashes of blocks within the timestamp range provided (requires timestampindex to be enabled).\n"
+            "\nArguments:\n"
+            "1. high         (numeric, required) The newer block timestamp, excluded\n"
+            "2. low          (numeric, required) The older block timestamp\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"hash\"         (string) The block hash\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockhashes", "1231614698 1231024505")
+            + HelpExampleRpc("getblockhashes", "1231614698, 1231024505")
+        );
+
+    unsigned int high = params[0].get_int();
+    unsigned int low = params[1].get_int();
+    std::vector<uint256> blockHashes;
+
+    if (!GetTimestampIndex(high, low, blockHashes))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information for block hashes");
+
+    UniValue result(UniValue::VARR);
+    for (std::vector<uint256>::const_iterator it=blockHashes.begin(); it!=blockHashes.end(); it++)
+        result.push_back(it->GetHex());
+    return result;
+}
+
 /*uint256 _safecoin_getblockhash(int32_t nHeight)
 {
     uint256 hash;
@@ -526,7 +556,8 @@ int32_t safecoin_notaries(uint8_t pubkeys[64][33],int32_t height);
 char *bitcoin_address(char *coinaddr,uint8_t addrtype,uint8_t *pubkey_or_rmd160,int32_t len);
 //uint32_t safecoin_interest_args(int32_t *txheightp,uint32_t *tiptimep,uint64_t *valuep,uint256 hash,int32_t n);
 int32_t safecoin_minerids(uint8_t *minerids,int32_t height,int32_t width);
-int32_t safecoin_kvsearch(uint256 *refpubkeyp,int32_t current_height,uint32_t *flagsp,int32_t *heightp,uint8_t value[IGUANA_MAXSCRIPTSIZE],uint8_t *key,int32_t keylen);
+int32_t safecoin_kvlookup(uint256 *refpubkeyp,int32_t current_height,uint32_t *flagsp,int32_t *heightp,uint8_t value[IGUANA_MAXSCRIPTSIZE],uint8_t *key,int32_t keylen,int32_t *pendingp);
+int32_t safecoin_kvkeys(std::vector<std::vector<uint8_t> > &keys,uint8_t *prefix,int32_t prefixlen,int32_t current_height,int32_t maxkeys);
 /*uint64_t conv_NXTpassword(unsigned char *mysecret,unsigned char *mypublic,uint8_t *pass,int32_t passlen);
 
 
@@ -544,22 +575,19 @@ UniValue passphrasewif(const UniValue& params, bool fHelp)
     return ret;
 }*/
 
-UniValue kvsearch(const UniValue& params, bool fHelp)
+UniValue kvsearchkey(const std::string &keystr)
 {
-    UniValue ret(UniValue::VOBJ); uint32_t flags; uint8_t value[IGUANA_MAXSCRIPTSIZE],key[IGUANA_MAXSCRIPTSIZE]; int32_t duration,j,height,valuesize,keylen; uint256 refpubkey; static uint256 zeroes;
-    if (fHelp || params.size() != 1 )
-        throw runtime_error("kvsearch key");
-    LOCK(cs_main);
-    if ( (keylen= (int32_t)strlen(params[0].get_str().c_str())) > 0 )
+    UniValue ret(UniValue::VOBJ); uint32_t flags; uint8_t value[IGUANA_MAXSCRIPTSIZE],key[IGUANA_MAXSCRIPTSIZE]; int32_t duration,height,valuesize,keylen,pending; uint256 refpubkey; static uint256 zeroes;
+    if ( (keylen= (int32_t)strlen(keystr.c_str())) > 0 )
     {
         ret.push_back(Pair("coin",(char *)(ASSETCHAINS_SYMBOL[0] == 0 ? "SAFE" : ASSETCHAINS_SYMBOL)));
         ret.push_back(Pair("currentheight", (int64_t)chainActive.Tip()->nHeight));
-        ret.push_back(Pair("key",params[0].get_str()));
+        ret.push_back(Pair("key",keystr));
         ret.push_back(Pair("keylen",keylen));
         if ( keylen < sizeof(key) )
         {
-            memcpy(key,params[0].get_str().c_str(),keylen);
-            if ( (valuesize= safecoin_kvsearch(&refpubkey,chainActive.Tip()->nHeight,&flags,&height,value,key,keylen)) >= 0 )
+            memcpy(key,keystr.c_str(),keylen);
+            if ( (valuesize= safecoin_kvlookup(&refpubkey,chainActive.Tip()->nHeight,&flags,&height,value,key,keylen,&pending)) >= 0 )
             {
                 std::string val; char *valuestr;
                 val.resize(valuesize);
@@ -573,12 +601,49 @@ UniValue kvsearch(const UniValue& params, bool fHelp)
                 ret.push_back(Pair("flags",(int64_t)flags));
                 ret.push_back(Pair("value",val));
                 ret.push_back(Pair("valuesize",valuesize));
+                if ( pending != 0 )
+                    ret.push_back(Pair("pending",pending));
             } else ret.push_back(Pair("error",(char *)"cant find key"));
         } else ret.push_back(Pair("error",(char *)"key too big"));
     } else ret.push_back(Pair("error",(char *)"null key"));
     return ret;
 }
 
+UniValue kvsearch(const UniValue& params, bool fHelp)
+{
+    UniValue ret(UniValue::VARR); std::vector<std::vector<uint8_t> > keys; int32_t i,maxkeys = 1000;
+    if (fHelp || params.size() < 1 || params.size() > 3 )
+        throw runtime_error(
+            "kvsearch \"key\" ( prefix maxresults )\n"
+            "\nLooks up key in the kv store, including updates still in the mempool.\n"
+            "\nArguments:\n"
+            "1. \"key\"        (string or array of strings, required) the key, or keys to look up in one call\n"
+            "2. prefix         (boolean, optional, default=false) list the live keys starting with key instead\n"
+            "3. maxresults     (numeric, optional, default=1000) the most keys a prefix search returns\n"
+            "\nExamples:\n"
+            + HelpExampleCli("kvsearch", "\"mykey\"")
+            + HelpExampleCli("kvsearch", "\"my\" true 10")
+            + HelpExampleRpc("kvsearch", "[\"mykey\", \"otherkey\"]")
+        );
+    LOCK(cs_main);
+    if ( params[0].isArray() )
+    {
+        const UniValue &a = params[0].get_array();
+        for (i=0; i<a.size(); i++)
+            ret.push_back(kvsearchkey(a[i].get_str()));
+        return ret;
+    }
+    if ( params.size() < 2 || params[1].get_bool() == false )
+        return kvsearchkey(params[0].get_str());
+    if ( params.size() > 2 && (maxkeys= params[2].get_int()) <= 0 )
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "maxresults must be positive");
+    const std::string &prefix = params[0].get_str();
+    safecoin_kvkeys(keys,(uint8_t *)prefix.data(),(int32_t)prefix.size(),chainActive.Tip()->nHeight,maxkeys);
+    for (i=0; i<keys.size(); i++)
+        ret.push_back(std::string(keys[i].begin(),keys[i].end()));
+    return ret;
+}
+
 UniValue minerids(const UniValue& params, bool fHelp)
 {
     UniValue ret(UniValue::VOBJ); UniValue a(UniValue::VARR); uint8_t minerids[2000],pubkeys[65][33]; int32_t i,j,n,numnotaries,tally[129];
@@ -788,6 +853,7 @@ UniValue paxprices(const UniValue& params, bool fHelp)
 }
 
 uint64_t safecoin_accrued_interest(int32_t *txheightp,uint32_t *locktimep,uint256 hash,int32_t n,int32_t checkheight,uint64_t checkvalue);
+uint64_t safecoin_coins_interest(int32_t txheight,uint32_t locktime,uint64_t value);
 
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
@@ -860,7 +926,10 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     else ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
     ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
     uint64_t interest; int32_t txheight; uint32_t locktime;
-    if ( (interest= safecoin_accrued_interest(&txheight,&locktime,hash,n,coins.nHeight,coins.vout[n].nValue)) != 0 )
+    if ( coins.fHaveLockTime != 0 )
+        interest = safecoin_coins_interest(coins.nHeight,coins.nLockTime,coins.vout[n].nValue);
+    else interest = safecoin_accrued_interest(&txheight,&locktime,hash,n,coins.nHeight,coins.vout[n].nValue);
+    if ( interest != 0 )
         ret.push_back(Pair("interest", ValueFromAmount(interest)));
     UniValue o(UniValue::VOBJ);
     ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
@@ -46,6 +46,14 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getbalance", 1 },
     { "getbalance", 2 },
     { "getblockhash", 0 },
+    { "getblockhashes", 0 },
+    { "getblockhashes", 1 },
+    { "getaddressmempool", 0 },
+    { "getaddressutxos", 0 },
+    { "getaddressdeltas", 0 },
+    { "getaddresstxids", 0 },
+    { "getaddressbalance", 0 },
+    { "getspentinfo", 0 },
     { "move", 2 },
     { "move", 3 },
     { "sendfrom", 2 },
@@ -59,6 +67,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblocktemplate", 0 },
     { "listsinceblock", 1 },
     { "listsinceblock", 2 },
+    { "sendbatch", 1 },
+    { "sendbatch", 2 },
     { "sendmany", 1 },
     { "sendmany", 2 },
     { "sendmany", 4 },
@@ -118,6 +128,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "notaries", 1 },
     { "minerids", 1 },
     { "kvsearch", 1 },
+    { "kvsearch", 2 },
     { "kvupdate", 4 },
     { "z_importkey", 2 },
 };
@@ -281,6 +281,7 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getblockcount",          &getblockcount,          true  },
     { "blockchain",         "getblock",               &getblock,               true  },
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
+    { "blockchain",         "getblockhashes",         &getblockhashes,         true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
@@ -330,6 +331,14 @@ static const CRPCCommand vRPCCommands[] =
 #endif
 
     /* Utility functions */
+    /* Address index */
+    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true  },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        true  },
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       true  },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        true  },
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      true  },
+    { "addressindex",       "getspentinfo",           &getspentinfo,           true  },
+
     { "util",               "createmultisig",         &createmultisig,         true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "verifymessage",          &verifymessage,          true  },
@@ -382,6 +391,7 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "lockunspent",            &lockunspent,            true  },
     { "wallet",             "move",                   &movecmd,                false },
     { "wallet",             "sendfrom",               &sendfrom,               false },
+    { "wallet",             "sendbatch",              &sendbatch,              false },
     { "wallet",             "sendmany",               &sendmany,               false },
     { "wallet",             "sendtoaddress",          &sendtoaddress,          false },
     { "wallet",             "setaccount",             &setaccount,             true  },
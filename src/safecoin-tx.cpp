@@ -36,6 +36,11 @@ uint64_t safecoin_accrued_interest(int32_t *txheightp,uint32_t *locktimep,uint25
     return(0);
 }
 
+uint64_t safecoin_coins_interest(int32_t txheight,uint32_t locktime,uint64_t value)
+{
+    return(0);
+}
+
 static bool fCreateBlank;
 static map<string,UniValue> registers;
 
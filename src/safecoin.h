@@ -36,7 +36,7 @@
 
 int32_t gettxout_scriptPubKey(uint8_t *scriptPubkey,int32_t maxsize,uint256 txid,int32_t n);
 void safecoin_event_rewind(struct safecoin_state *sp,char *symbol,int32_t height);
-void safecoin_connectblock(CBlockIndex *pindex,CBlock& block);
+void safecoin_connectblock(CBlockIndex *pindex,CBlock& block,const CBlockUndo *blockundo);
 
 #include "safecoin_structs.h"
 #include "safecoin_globals.h"
@@ -219,7 +219,7 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
             errs++;
         if ( func == 'P' )
         {
-            if ( (num= filedata[fpos++]) <= 64 )
+            if ( fpos < datalen && (num= filedata[fpos++]) <= 64 )
             {
                 if ( memread(pubkeys,33*num,filedata,&fpos,datalen) != 33*num )
                     errs++;
@@ -247,8 +247,10 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
         else if ( func == 'U' ) // deprecated
         {
             uint8_t n,nid; uint256 hash; uint64_t mask;
-            n = filedata[fpos++];
-            nid = filedata[fpos++];
+            if ( memread(&n,sizeof(n),filedata,&fpos,datalen) != sizeof(n) )
+                errs++;
+            if ( memread(&nid,sizeof(nid),filedata,&fpos,datalen) != sizeof(nid) )
+                errs++;
             //printf("U %d %d\n",n,nid);
             if ( memread(&mask,sizeof(mask),filedata,&fpos,datalen) != sizeof(mask) )
                 errs++;
@@ -297,9 +299,7 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
                 safecoin_eventadd_opreturn(sp,symbol,ht,txid,ovalue,v,opret,olen); // global shared state -> global PAX
             } else
             {
-                int32_t i;
-                for (i=0; i<olen; i++)
-                    filedata[fpos++];
+                fpos += olen;
                 //printf("illegal olen.%u\n",olen);
             }
         }
@@ -310,7 +310,7 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
         else if ( func == 'V' )
         {
             int32_t numpvals; uint32_t pvals[128];
-            numpvals = filedata[fpos++];
+            numpvals = (fpos < datalen) ? filedata[fpos++] : 0xff;
             if ( numpvals*sizeof(uint32_t) <= sizeof(pvals) && memread(pvals,(int32_t)(sizeof(uint32_t)*numpvals),filedata,&fpos,datalen) == numpvals*sizeof(uint32_t) )
             {
                 //if ( matched != 0 ) global shared state -> global PVALS
@@ -617,25 +617,35 @@ int32_t safecoin_voutupdate(int32_t *isratificationp,int32_t notaryid,uint8_t *s
 
 int32_t gettxout_scriptPubKey(uint8_t *scriptPubKey,int32_t maxsize,uint256 txid,int32_t n);
 
-int32_t safecoin_notarycmp(uint8_t *scriptPubKey,int32_t scriptlen,uint8_t pubkeys[64][33],int32_t numnotaries,uint8_t rmd160[20])
+int32_t safecoin_notarycmp(uint8_t *scriptPubKey,int32_t scriptlen,const struct safecoin_notarytable *nt)
 {
-    int32_t i;
-    if ( scriptlen == 25 && memcmp(&scriptPubKey[3],rmd160,20) == 0 )
+    if ( scriptlen == 25 && memcmp(&scriptPubKey[3],nt->rmd160,20) == 0 )
         return(0);
     else if ( scriptlen == 35 )
+        return(safecoin_notaryid(nt,&scriptPubKey[1]));
+    return(-1);
+}
+
+// scriptPubKey spent by vin j of tx i: straight from the block undo data when connecting, txindex lookup otherwise
+int32_t safecoin_vinscript(uint8_t *scriptPubKey,int32_t maxsize,CBlock& block,const CBlockUndo *blockundo,int32_t i,int32_t j)
+{
+    int32_t k,m; const CScript *script;
+    if ( blockundo != 0 && i > 0 && i-1 < blockundo->vtxundo.size() && j < blockundo->vtxundo[i-1].vprevout.size() )
     {
-        for (i=0; i<numnotaries; i++)
-            if ( memcmp(&scriptPubKey[1],pubkeys[i],33) == 0 )
-                return(i);
+        script = &blockundo->vtxundo[i-1].vprevout[j].txout.scriptPubKey;
+        m = script->size();
+        for (k=0; k<maxsize&&k<m; k++)
+            scriptPubKey[k] = (*script)[k];
+        return(k);
     }
-    return(-1);
+    return(gettxout_scriptPubKey(scriptPubKey,maxsize,block.vtx[i].vin[j].prevout.hash,block.vtx[i].vin[j].prevout.n));
 }
 
-void safecoin_connectblock(CBlockIndex *pindex,CBlock& block)
+void safecoin_connectblock(CBlockIndex *pindex,CBlock& block,const CBlockUndo *blockundo)
 {
     static int32_t hwmheight;
     uint64_t signedmask,voutmask; char symbol[SAFECOIN_ASSETCHAIN_MAXLEN],dest[SAFECOIN_ASSETCHAIN_MAXLEN]; struct safecoin_state *sp;
-    uint8_t scriptbuf[4096],pubkeys[64][33],rmd160[20],scriptPubKey[35]; uint256 SAFEtxid,zero,btctxid,txhash;
+    uint8_t scriptbuf[4096],pubkeys[64][33],scriptPubKey[35]; uint256 SAFEtxid,zero,btctxid,txhash;
     int32_t i,j,k,numnotaries,notarized,scriptlen,isratification,nid,numvalid,specialtx,notarizedheight,notaryid,len,numvouts,numvins,height,txn_count;
     memset(&zero,0,sizeof(zero));
     safecoin_init(pindex->nHeight);
@@ -646,8 +656,8 @@ void safecoin_connectblock(CBlockIndex *pindex,CBlock& block)
         return;
     }
     //fprintf(stderr,"%s connect.%d\n",ASSETCHAINS_SYMBOL,pindex->nHeight);
-    numnotaries = safecoin_notaries(pubkeys,pindex->nHeight);
-    calc_rmd160_sha256(rmd160,pubkeys[0],33);
+    const struct safecoin_notarytable *nt = safecoin_electedtable();
+    numnotaries = nt->numnotaries;
     if ( pindex->nHeight > hwmheight )
         hwmheight = pindex->nHeight;
     else
@@ -674,9 +684,9 @@ void safecoin_connectblock(CBlockIndex *pindex,CBlock& block)
             {
                 if ( i == 0 && j == 0 )
                     continue;
-                if ( (scriptlen= gettxout_scriptPubKey(scriptPubKey,sizeof(scriptPubKey),block.vtx[i].vin[j].prevout.hash,block.vtx[i].vin[j].prevout.n)) > 0 )
+                if ( (scriptlen= safecoin_vinscript(scriptPubKey,sizeof(scriptPubKey),block,blockundo,i,j)) > 0 )
                 {
-                    if ( (k= safecoin_notarycmp(scriptPubKey,scriptlen,pubkeys,numnotaries,rmd160)) >= 0 )
+                    if ( (k= safecoin_notarycmp(scriptPubKey,scriptlen,nt)) >= 0 )
                         signedmask |= (1LL << k);
                     else if ( 0 && numvins >= 17 )
                     {
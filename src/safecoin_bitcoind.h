@@ -696,11 +696,18 @@ void safecoin_index2pubkey33(uint8_t *pubkey33,CBlockIndex *pindex,int32_t heigh
     }
 }
 
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+
 void safecoin_connectpindex(CBlockIndex *pindex)
 {
-    CBlock block;
+    CBlock block; CBlockUndo blockundo; CDiskBlockPos pos;
     if ( safecoin_blockload(block,pindex) == 0 )
-        safecoin_connectblock(pindex,block);
+    {
+        pos = pindex->GetUndoPos();
+        if ( pindex->pprev != 0 && !pos.IsNull() && UndoReadFromDisk(blockundo,pos,pindex->pprev->GetBlockHash()) )
+            safecoin_connectblock(pindex,block,&blockundo);
+        else safecoin_connectblock(pindex,block,0);
+    }
 }
 
 int32_t safecoin_notaries(uint8_t pubkeys[64][33],int32_t height);
@@ -708,20 +715,13 @@ int32_t safecoin_electednotary(uint8_t *pubkey33,int32_t height);
 
 int8_t safecoin_minerid(int32_t height,uint8_t *pubkey33)
 {
-    int32_t num,i; CBlockIndex *pindex; uint8_t _pubkey33[33],pubkeys[64][33];
-    if ( pubkey33 == 0 && (pindex= chainActive[height]) != 0 )
+    CBlockIndex *pindex; uint8_t _pubkey33[33];
+    if ( pubkey33 == 0 )
     {
-        if ( pubkey33 == 0 )
-        {
-            pubkey33 = _pubkey33;
-            safecoin_index2pubkey33(pubkey33,pindex,height);
-        }
-        if ( (num= safecoin_notaries(pubkeys,height)) > 0 )
-        {
-            for (i=0; i<num; i++)
-                if ( memcmp(pubkeys[i],pubkey33,33) == 0 )
-                    return(i);
-        }
+        if ( (pindex= chainActive[height]) == 0 )
+            return(-1);
+        pubkey33 = _pubkey33;
+        safecoin_index2pubkey33(pubkey33,pindex,height);
     }
     return(safecoin_electednotary(pubkey33,height));
 }
@@ -856,6 +856,18 @@ uint64_t safecoin_accrued_interest(int32_t *txheightp,uint32_t *locktimep,uint25
     return(0);
 }
 
+// same result as safecoin_accrued_interest, but from the height and lock time cached in the coins entry
+uint64_t safecoin_coins_interest(int32_t txheight,uint32_t locktime,uint64_t value)
+{
+    CBlockIndex *tipindex;
+    if ( locktime == 0 || txheight <= 0 || (uint32_t)txheight == MEMPOOL_HEIGHT )
+        return(0);
+    LOCK(cs_main);
+    if ( (tipindex= chainActive.Tip()) == 0 )
+        return(0);
+    return(safecoin_interest(txheight,value,locktime,tipindex->nTime));
+}
+
 int32_t safecoin_isrealtime(int32_t *SAFEheightp)
 {
     struct safecoin_state *sp; CBlockIndex *pindex;
@@ -17,20 +17,57 @@
 #define H_SAFECOINEVENTS_H
 #include "safecoin_defs.h"
 
+struct safecoin_event *safecoin_eventalloc(struct safecoin_state *sp,uint16_t len)
+{
+    struct safecoin_eventchunk *cp = sp->Safecoin_eventchunks; struct safecoin_event *ep; uint32_t size,alignedlen = (len + 7) & ~7;
+    if ( cp == 0 || cp->used + alignedlen > cp->size )
+    {
+        size = (alignedlen > SAFECOIN_EVENTCHUNK_SIZE) ? alignedlen : SAFECOIN_EVENTCHUNK_SIZE;
+        cp = (struct safecoin_eventchunk *)malloc(sizeof(*cp) + size);
+        cp->prev = sp->Safecoin_eventchunks;
+        cp->used = 0;
+        cp->size = size;
+        sp->Safecoin_eventchunks = cp;
+    }
+    ep = (struct safecoin_event *)&cp->space[cp->used];
+    cp->used += alignedlen;
+    memset(ep,0,len);
+    return(ep);
+}
+
+// only the most recent event can be released, which is all a rewind ever does
+void safecoin_eventrelease(struct safecoin_state *sp,struct safecoin_event *ep)
+{
+    struct safecoin_eventchunk *cp;
+    if ( (cp= sp->Safecoin_eventchunks) != 0 && (uint8_t *)ep >= cp->space && (uint8_t *)ep < &cp->space[cp->used] )
+    {
+        cp->used = (uint32_t)((uint8_t *)ep - cp->space);
+        if ( cp->used == 0 )
+        {
+            sp->Safecoin_eventchunks = cp->prev;
+            free(cp);
+        }
+    }
+}
+
 struct safecoin_event *safecoin_eventadd(struct safecoin_state *sp,int32_t height,char *symbol,uint8_t type,uint8_t *data,uint16_t datalen)
 {
     struct safecoin_event *ep=0; uint16_t len = (uint16_t)(sizeof(*ep) + datalen);
     if ( sp != 0 )
     {
         portable_mutex_lock(&safecoin_mutex);
-        ep = (struct safecoin_event *)calloc(1,len);
+        ep = safecoin_eventalloc(sp,len);
         ep->len = len;
         ep->height = height;
         ep->type = type;
         strcpy(ep->symbol,symbol);
         if ( datalen != 0 )
             memcpy(ep->space,data,datalen);
-        sp->Safecoin_events = (struct safecoin_event **)realloc(sp->Safecoin_events,(1 + sp->Safecoin_numevents) * sizeof(*sp->Safecoin_events));
+        if ( sp->Safecoin_numevents >= sp->Safecoin_maxevents )
+        {
+            sp->Safecoin_maxevents = (sp->Safecoin_maxevents < 1024) ? 1024 : (sp->Safecoin_maxevents << 1);
+            sp->Safecoin_events = (struct safecoin_event **)realloc(sp->Safecoin_events,sp->Safecoin_maxevents * sizeof(*sp->Safecoin_events));
+        }
         sp->Safecoin_events[sp->Safecoin_numevents++] = ep;
         portable_mutex_unlock(&safecoin_mutex);
     }
@@ -128,17 +165,18 @@ void safecoin_event_rewind(struct safecoin_state *sp,char *symbol,int32_t height
             SAFECOIN_LASTMINED = prevSAFECOIN_LASTMINED;
             prevSAFECOIN_LASTMINED = 0;
         }
+        portable_mutex_lock(&safecoin_mutex);
         while ( sp->Safecoin_events != 0 && sp->Safecoin_numevents > 0 )
         {
-            if ( (ep= sp->Safecoin_events[sp->Safecoin_numevents-1]) != 0 )
-            {
-                if ( ep->height < height )
-                    break;
-                //printf("[%s] undo %s event.%c ht.%d for rewind.%d\n",ASSETCHAINS_SYMBOL,symbol,ep->type,ep->height,height);
-                safecoin_event_undo(sp,ep);
-                sp->Safecoin_numevents--;
-            }
+            ep = sp->Safecoin_events[sp->Safecoin_numevents-1];
+            if ( ep->height < height )
+                break;
+            //printf("[%s] undo %s event.%c ht.%d for rewind.%d\n",ASSETCHAINS_SYMBOL,symbol,ep->type,ep->height,height);
+            safecoin_event_undo(sp,ep);
+            sp->Safecoin_numevents--;
+            safecoin_eventrelease(sp,ep);
         }
+        portable_mutex_unlock(&safecoin_mutex);
     }
 }
 
@@ -16,6 +16,13 @@
 // paxdeposit equivalent in reverse makes opreturn and SAFE does the same in reverse
 #include "safecoin_defs.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 int32_t pax_fiatstatus(uint64_t *available,uint64_t *deposited,uint64_t *issued,uint64_t *withdrawn,uint64_t *approved,uint64_t *redeemed,char *base)
 {
     int32_t baseid; struct safecoin_state *sp; int64_t netliability,maxallowed,maxval;
@@ -1483,6 +1490,37 @@ uint8_t *OS_fileptr(long *allocsizep,char *fname)
     return((uint8_t *)retptr);
 }
 
+// read-only view of a whole file, mapped where possible so replaying a large safecoinstate doesnt copy it onto the heap
+uint8_t *OS_mapfile(long *filesizep,char *fname)
+{
+#ifndef _WIN32
+    int fd; struct stat st; void *ptr;
+    *filesizep = 0;
+    if ( (fd= open(fname,O_RDONLY)) < 0 )
+        return(0);
+    if ( fstat(fd,&st) != 0 || st.st_size == 0 || (ptr= mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED )
+    {
+        close(fd);
+        return(0);
+    }
+    close(fd);
+    *filesizep = (long)st.st_size;
+    return((uint8_t *)ptr);
+#else
+    return(OS_fileptr(filesizep,fname));
+#endif
+}
+
+void OS_releasemap(uint8_t *ptr,long filesize)
+{
+#ifndef _WIN32
+    if ( ptr != 0 )
+        munmap(ptr,filesize);
+#else
+    free(ptr);
+#endif
+}
+
 long safecoin_stateind_validate(struct safecoin_state *sp,char *indfname,uint8_t *filedata,long datalen,uint32_t *prevpos100p,uint32_t *indcounterp,char *symbol,char *dest)
 {
     FILE *fp; long fsize,lastfpos=0,fpos=0; uint8_t *inds,func; int32_t i,n; uint32_t offset,tmp,prevpos100 = 0;
@@ -1553,7 +1591,7 @@ int32_t safecoin_faststateinit(struct safecoin_state *sp,char *fname,char *symbo
     starttime = (uint32_t)time(NULL);
     safecopy(indfname,fname,sizeof(indfname)-4);
     strcat(indfname,".ind");
-    if ( (filedata= OS_fileptr(&datalen,fname)) != 0 )
+    if ( (filedata= OS_mapfile(&datalen,fname)) != 0 )
     {
         if ( 1 )//datalen >= (1LL << 32) || GetArg("-genind",0) != 0 || (validated= safecoin_stateind_validate(0,indfname,filedata,datalen,&prevpos100,&indcounter,symbol,dest)) < 0 )
         {
@@ -1605,7 +1643,7 @@ int32_t safecoin_faststateinit(struct safecoin_state *sp,char *fname,char *symbo
                 }
             }
         } else printf("safecoin_faststateinit unexpected case\n");
-        free(filedata);
+        OS_releasemap(filedata,datalen);
         return(finished == 1);
     }
     return(-1);
@@ -1665,7 +1703,7 @@ void safecoin_passport_iteration()
                 safecoin_nameset(symbol,dest,base);
                 sp = safecoin_stateptrget(symbol);
                 n = 0;
-                if ( lastpos[baseid] == 0 && (filedata= OS_fileptr(&datalen,fname)) != 0 )
+                if ( lastpos[baseid] == 0 && (filedata= OS_mapfile(&datalen,fname)) != 0 )
                 {
                     fpos = 0;
                     fprintf(stderr,"%s processing %s %ldKB\n",ASSETCHAINS_SYMBOL,fname,datalen/1024);
@@ -1673,7 +1711,7 @@ void safecoin_passport_iteration()
                         lastfpos = fpos;
                     fprintf(stderr,"%s took %d seconds to process %s %ldKB\n",ASSETCHAINS_SYMBOL,(int32_t)(time(NULL)-starttime),fname,datalen/1024);
                     lastpos[baseid] = lastfpos;
-                    free(filedata), filedata = 0;
+                    OS_releasemap(filedata,datalen), filedata = 0;
                     datalen = 0;
                 }
                 else if ( (fp= fopen(fname,"rb")) != 0 && sp != 0 )
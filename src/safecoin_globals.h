@@ -29,6 +29,7 @@ uint64_t safecoin_maxallowed(int32_t baseid);
 int32_t safecoin_bannedset(int32_t *indallvoutsp,uint256 *array,int32_t max);
 
 pthread_mutex_t safecoin_mutex;
+int32_t SAFECOIN_NPOINTS_READERS; // safecoin_notarizeddata calls in progress
 
 #define SAFECOIN_ELECTION_GAP 2000    //((ASSETCHAINS_SYMBOL[0] == 0) ? 2000 : 100)
 #define IGUANA_MAXSCRIPTSIZE 10001
@@ -97,102 +97,285 @@ int32_t safecoin_kvsearch(uint256 *pubkeyp,int32_t current_height,uint32_t *flag
     return(retval);
 }
 
-void safecoin_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
+// decodes a 'K' opreturn and checks its fee and layout, key and value point into opretbuf
+int32_t safecoin_kvparse(struct safecoin_kvop *op,uint8_t *opretbuf,int32_t opretlen,uint64_t value)
 {
-    static uint256 zeroes;
-    uint32_t flags; uint256 pubkey,refpubkey,sig; int32_t i,refvaluesize,hassig,coresize,haspubkey,height,kvheight; uint16_t keylen,valuesize,newflag = 0; uint8_t *key,*valueptr,keyvalue[IGUANA_MAXSCRIPTSIZE]; struct safecoin_kv *ptr; char *transferpubstr,*tstr; uint64_t fee;
-    iguana_rwnum(0,&opretbuf[1],sizeof(keylen),&keylen);
-    iguana_rwnum(0,&opretbuf[3],sizeof(valuesize),&valuesize);
-    iguana_rwnum(0,&opretbuf[5],sizeof(height),&height);
-    iguana_rwnum(0,&opretbuf[9],sizeof(flags),&flags);
-    key = &opretbuf[13];
-    if ( keylen+13 > opretlen )
+    int32_t i; uint64_t fee;
+    memset(op,0,sizeof(*op));
+    iguana_rwnum(0,&opretbuf[1],sizeof(op->keylen),&op->keylen);
+    iguana_rwnum(0,&opretbuf[3],sizeof(op->valuesize),&op->valuesize);
+    iguana_rwnum(0,&opretbuf[5],sizeof(op->height),&op->height);
+    iguana_rwnum(0,&opretbuf[9],sizeof(op->flags),&op->flags);
+    op->key = &opretbuf[13];
+    if ( op->keylen+13 > opretlen )
     {
         static uint32_t counter;
         if ( ++counter < 1 )
-            printf("safecoin_kvupdate: keylen.%d + 13 > opretlen.%d, this can be ignored\n",keylen,opretlen);
+            printf("safecoin_kvupdate: keylen.%d + 13 > opretlen.%d, this can be ignored\n",op->keylen,opretlen);
+        return(-1);
+    }
+    op->value = &op->key[op->keylen];
+    fee = safecoin_kvfee(op->flags,opretlen,op->keylen);
+    //printf("fee %.8f vs %.8f flags.%d keylen.%d valuesize.%d height.%d (%02x %02x %02x) (%02x %02x %02x)\n",(double)fee/COIN,(double)value/COIN,op->flags,op->keylen,op->valuesize,op->height,op->key[0],op->key[1],op->key[2],op->value[0],op->value[1],op->value[2]);
+    if ( value < fee )
+        return(-1);
+    op->coresize = (int32_t)(sizeof(op->flags)+sizeof(op->height)+sizeof(op->keylen)+sizeof(op->valuesize)+op->keylen+op->valuesize+1);
+    if ( opretlen != op->coresize && opretlen != op->coresize+sizeof(uint256) && opretlen != op->coresize+2*sizeof(uint256) )
+    {
+        //printf("size mismatch %d vs %d\n",opretlen,op->coresize);
+        return(-1);
+    }
+    if ( opretlen >= op->coresize+sizeof(uint256) )
+    {
+        for (i=0; i<32; i++)
+            ((uint8_t *)&op->pubkey)[i] = opretbuf[op->coresize+i];
+    }
+    if ( opretlen == op->coresize+sizeof(uint256)*2 )
+    {
+        for (i=0; i<32; i++)
+            ((uint8_t *)&op->sig)[i] = opretbuf[op->coresize+sizeof(uint256)+i];
+    }
+    return(0);
+}
+
+// the update rules, given the live entry op replaces (refvaluesize < 0 if there is none):
+// -1 if rejected, else the new owner and flags and whether the stored value is replaced
+int32_t safecoin_kvapply(struct safecoin_kvop *op,int32_t refvaluesize,uint256 refpubkey,uint8_t *refvalue,uint32_t refflags,uint256 *pubkeyp,uint32_t *flagsp,int32_t *replacep)
+{
+    static uint256 zeroes;
+    uint8_t keyvalue[IGUANA_MAXSCRIPTSIZE]; char *transferpubstr,*tstr; int32_t i;
+    *pubkeyp = op->pubkey;
+    *flagsp = (refvaluesize >= 0 ? refflags : 0) | 1;
+    *replacep = 1;
+    if ( refvaluesize < 0 )
+        return(0);
+    if ( memcmp(&zeroes,&refpubkey,sizeof(refpubkey)) != 0 )
+    {
+        if ( op->keylen+refvaluesize > sizeof(keyvalue) )
+            return(-1);
+        memcpy(keyvalue,op->key,op->keylen);
+        memcpy(&keyvalue[op->keylen],refvalue,refvaluesize);
+        if ( safecoin_kvsigverify(keyvalue,op->keylen+refvaluesize,refpubkey,op->sig) < 0 )
+        {
+            printf("safecoin_kvsigverify error [%d]\n",op->coresize-13);
+            return(-1);
+        }
+    }
+    //if ( (refflags & SAFECOIN_KVPROTECTED) != 0 )
+    {
+        tstr = (char *)"transfer:";
+        transferpubstr = (char *)&op->value[strlen(tstr)];
+        if ( strncmp(tstr,(char *)op->value,strlen(tstr)) == 0 && is_hexstr(transferpubstr,0) == 64 )
+        {
+            printf("transfer.(%.*s) to [%s]? ishex.%d\n",op->keylen,op->key,transferpubstr,is_hexstr(transferpubstr,0));
+            for (i=0; i<32; i++)
+                ((uint8_t *)pubkeyp)[31-i] = _decode_hex(&transferpubstr[i*2]);
+        }
+    }
+    if ( (refflags & SAFECOIN_KVPROTECTED) != 0 )
+        *replacep = 0;
+    return(0);
+}
+
+void safecoin_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
+{
+    struct safecoin_kvop op; uint256 refpubkey,pubkey; uint32_t refflags,flags; int32_t refvaluesize,kvheight,replace; uint8_t refvalue[IGUANA_MAXSCRIPTSIZE]; struct safecoin_kv *ptr;
+    if ( safecoin_kvparse(&op,opretbuf,opretlen,value) < 0 )
+        return;
+    refvaluesize = safecoin_kvsearch(&refpubkey,op.height,&refflags,&kvheight,refvalue,op.key,op.keylen);
+    if ( safecoin_kvapply(&op,refvaluesize,refpubkey,refvalue,refflags,&pubkey,&flags,&replace) < 0 )
         return;
+    portable_mutex_lock(&SAFECOIN_KV_mutex);
+    HASH_FIND(hh,SAFECOIN_KV,op.key,op.keylen,ptr);
+    if ( ptr == 0 )
+    {
+        ptr = (struct safecoin_kv *)calloc(1,sizeof(*ptr));
+        ptr->key = (uint8_t *)calloc(1,op.keylen);
+        ptr->keylen = op.keylen;
+        memcpy(ptr->key,op.key,op.keylen);
+        replace = 1;
+        HASH_ADD_KEYPTR(hh,SAFECOIN_KV,ptr->key,ptr->keylen,ptr);
+        //printf("KV add.(%s) (%s)\n",ptr->key,op.value);
     }
-    valueptr = &key[keylen];
-    fee = safecoin_kvfee(flags,opretlen,keylen);
-    //printf("fee %.8f vs %.8f flags.%d keylen.%d valuesize.%d height.%d (%02x %02x %02x) (%02x %02x %02x)\n",(double)fee/COIN,(double)value/COIN,flags,keylen,valuesize,height,key[0],key[1],key[2],valueptr[0],valueptr[1],valueptr[2]);
-    if ( value >= fee )
+    if ( replace != 0 )
     {
-        coresize = (int32_t)(sizeof(flags)+sizeof(height)+sizeof(keylen)+sizeof(valuesize)+keylen+valuesize+1);
-        if ( opretlen == coresize || opretlen == coresize+sizeof(uint256) || opretlen == coresize+2*sizeof(uint256) )
+        if ( ptr->value != 0 )
+            free(ptr->value), ptr->value = 0;
+        if ( (ptr->valuesize= op.valuesize) != 0 )
         {
-            memset(&pubkey,0,sizeof(pubkey));
-            memset(&sig,0,sizeof(sig));
-            if ( (haspubkey= (opretlen >= coresize+sizeof(uint256))) != 0 )
-            {
-                for (i=0; i<32; i++)
-                    ((uint8_t *)&pubkey)[i] = opretbuf[coresize+i];
-            }
-            if ( (hassig= (opretlen == coresize+sizeof(uint256)*2)) != 0 )
-            {
-                for (i=0; i<32; i++)
-                    ((uint8_t *)&sig)[i] = opretbuf[coresize+sizeof(uint256)+i];
-            }
-            memcpy(keyvalue,key,keylen);
-            if ( (refvaluesize= safecoin_kvsearch((uint256 *)&refpubkey,height,&flags,&kvheight,&keyvalue[keylen],key,keylen)) >= 0 )
-            {
-                if ( memcmp(&zeroes,&refpubkey,sizeof(refpubkey)) != 0 )
-                {
-                    if ( safecoin_kvsigverify(keyvalue,keylen+refvaluesize,refpubkey,sig) < 0 )
-                    {
-                        printf("safecoin_kvsigverify error [%d]\n",coresize-13);
-                        return;
-                    }
-                }
-            }
-            portable_mutex_lock(&SAFECOIN_KV_mutex);
-            HASH_FIND(hh,SAFECOIN_KV,key,keylen,ptr);
-            if ( ptr != 0 )
-            {
-                //if ( (ptr->flags & SAFECOIN_KVPROTECTED) != 0 )
-                {
-                    tstr = (char *)"transfer:";
-                    transferpubstr = (char *)&valueptr[strlen(tstr)];
-                    if ( strncmp(tstr,(char *)valueptr,strlen(tstr)) == 0 && is_hexstr(transferpubstr,0) == 64 )
-                    {
-                        printf("transfer.(%s) to [%s]? ishex.%d\n",key,transferpubstr,is_hexstr(transferpubstr,0));
-                        for (i=0; i<32; i++)
-                            ((uint8_t *)&pubkey)[31-i] = _decode_hex(&transferpubstr[i*2]);
-                    }
-                }
-            }
-            else if ( ptr == 0 )
-            {
-                ptr = (struct safecoin_kv *)calloc(1,sizeof(*ptr));
-                ptr->key = (uint8_t *)calloc(1,keylen);
-                ptr->keylen = keylen;
-                memcpy(ptr->key,key,keylen);
-                newflag = 1;
-                HASH_ADD_KEYPTR(hh,SAFECOIN_KV,ptr->key,ptr->keylen,ptr);
-                //printf("KV add.(%s) (%s)\n",ptr->key,valueptr);
-            }
-            if ( newflag != 0 || (ptr->flags & SAFECOIN_KVPROTECTED) == 0 )
+            ptr->value = (uint8_t *)calloc(1,op.valuesize);
+            memcpy(ptr->value,op.value,op.valuesize);
+        }
+    }
+    memcpy(&ptr->pubkey,&pubkey,sizeof(ptr->pubkey));
+    ptr->height = op.height;
+    ptr->flags = flags;
+    portable_mutex_unlock(&SAFECOIN_KV_mutex);
+}
+
+// opreturn of vout j of tx i if safecoin_connectblock would hand it to safecoin_kvupdate, -1 otherwise
+int32_t safecoin_kvopret(uint8_t **opretp,const CTxOut &vout,int32_t i,int32_t j)
+{
+    const uint8_t *script = vout.scriptPubKey.data(); int32_t k,len = 0,opretlen,scriptlen = (int32_t)vout.scriptPubKey.size();
+    const char *symbol = ASSETCHAINS_SYMBOL[0] == 0 ? "SAFE" : ASSETCHAINS_SYMBOL;
+    if ( scriptlen < sizeof(uint32_t) || scriptlen > 4096 || script[len++] != 0x6a )
+        return(-1);
+    if ( (opretlen= script[len++]) == 0x4c )
+        opretlen = script[len++];
+    else if ( opretlen == 0x4d )
+    {
+        opretlen = script[len++];
+        opretlen += (script[len++] << 8);
+    }
+    if ( len+opretlen > scriptlen || opretlen == 40 || script[len] != 'K' )
+        return(-1);
+    if ( opretlen >= 32*2+4 && strncmp(symbol,(char *)&script[len+32*2+4],opretlen-(32*2+4)) == 0 && strlen(symbol) < opretlen-(32*2+4) )
+    {
+        if ( j == 1 )
+            return(-1); // notarization
+    }
+    if ( i == 0 && j == 1 && opretlen == 149 )
+        return(-1); // price feed
+    *opretp = (uint8_t *)&script[len];
+    return(opretlen);
+}
+
+CKVIndexValue &safecoin_kvindex_entry(std::map<std::vector<unsigned char>,CKVIndexValue> &mapEntries,CKVIndexUndo &undo,const std::vector<unsigned char> &key)
+{
+    std::map<std::vector<unsigned char>,CKVIndexValue>::iterator it; CKVIndexValue value;
+    if ( (it= mapEntries.find(key)) != mapEntries.end() )
+        return(it->second);
+    if ( pblocktree->ReadKV(key,value) == 0 )
+        value.SetNull();
+    undo.vPrev.push_back(std::make_pair(key,value));
+    return(mapEntries[key] = value);
+}
+
+// applies the kv updates of a block to -kvindex after dropping every entry that expired before it,
+// together with what is needed to take the block back out
+bool safecoin_kvindex_connect(const CBlock &block,CBlockIndex *pindex)
+{
+    std::map<std::vector<unsigned char>,CKVIndexValue> mapEntries; std::vector<std::vector<unsigned char> > vExpired; CKVIndexUndo undo;
+    struct safecoin_kvop op; uint256 pubkey; uint32_t flags; uint8_t *opret; int32_t i,j,opretlen,refvaluesize,replace;
+    if ( pblocktree->HaveKVBlock(pindex->GetBlockHash()) != 0 )
+        return(true); // already applied before a restart
+    if ( pblocktree->ReadKVExpired(pindex->nHeight,vExpired) == 0 )
+        return(false);
+    for (i=0; i<vExpired.size(); i++)
+        safecoin_kvindex_entry(mapEntries,undo,vExpired[i]).SetNull();
+    for (i=0; i<block.vtx.size(); i++)
+    {
+        for (j=0; j<block.vtx[i].vout.size(); j++)
+        {
+            if ( (opretlen= safecoin_kvopret(&opret,block.vtx[i].vout[j],i,j)) < 0 || safecoin_kvparse(&op,opret,opretlen,(uint64_t)block.vtx[i].vout[j].nValue) < 0 )
+                continue;
+            std::vector<unsigned char> key(op.key,op.key+op.keylen);
+            CKVIndexValue &entry = safecoin_kvindex_entry(mapEntries,undo,key);
+            refvaluesize = (entry.IsNull() || op.height > entry.nExpiration) ? -1 : (int32_t)entry.vchValue.size();
+            if ( safecoin_kvapply(&op,refvaluesize,entry.pubkey,refvaluesize > 0 ? &entry.vchValue[0] : 0,entry.nFlags,&pubkey,&flags,&replace) < 0 )
+                continue;
+            if ( replace != 0 )
+                entry.vchValue.assign(op.value,op.value+op.valuesize);
+            entry.pubkey = pubkey;
+            entry.nHeight = op.height;
+            entry.nFlags = flags;
+            entry.nExpiration = op.height + safecoin_kvduration(flags);
+        }
+    }
+    if ( undo.vPrev.empty() != 0 )
+        return(true); // nothing touched, nothing to undo
+    std::vector<std::pair<std::vector<unsigned char>,CKVIndexValue> > vEntries(mapEntries.begin(),mapEntries.end());
+    return(pblocktree->WriteKVBlock(pindex->GetBlockHash(),undo,vEntries));
+}
+
+// pending kv updates in the mempool, applied in arrival order on top of the confirmed entry for key
+int32_t safecoin_kvmempool(uint256 *pubkeyp,uint32_t *flagsp,int32_t *heightp,uint8_t value[IGUANA_MAXSCRIPTSIZE],int32_t valuesize,uint8_t *key,int32_t keylen,int32_t *pendingp)
+{
+    struct safecoin_kvop op; uint256 pubkey; uint32_t flags; uint8_t *opret; int32_t j,opretlen,refvaluesize,replace;
+    *pendingp = 0;
+    LOCK(mempool.cs);
+    for (CTxMemPool::indexed_transaction_set::index<entry_time>::type::iterator it=mempool.mapTx.get<entry_time>().begin(); it!=mempool.mapTx.get<entry_time>().end(); it++)
+    {
+        const CTransaction &tx = it->GetTx();
+        for (j=0; j<tx.vout.size(); j++)
+        {
+            if ( (opretlen= safecoin_kvopret(&opret,tx.vout[j],1,j)) < 0 || safecoin_kvparse(&op,opret,opretlen,(uint64_t)tx.vout[j].nValue) < 0 )
+                continue;
+            if ( op.keylen != keylen || memcmp(op.key,key,keylen) != 0 || op.valuesize > IGUANA_MAXSCRIPTSIZE )
+                continue;
+            refvaluesize = (valuesize < 0 || op.height > *heightp + safecoin_kvduration(*flagsp)) ? -1 : valuesize;
+            if ( safecoin_kvapply(&op,refvaluesize,*pubkeyp,value,*flagsp,&pubkey,&flags,&replace) < 0 )
+                continue;
+            if ( replace != 0 )
+                memcpy(value,op.value,(valuesize= op.valuesize));
+            *pubkeyp = pubkey;
+            *flagsp = flags;
+            *heightp = op.height;
+            (*pendingp)++;
+        }
+    }
+    return(valuesize);
+}
+
+// kvsearch for RPC: -kvindex when enabled, the replayed in-memory store otherwise, plus pending mempool updates
+int32_t safecoin_kvlookup(uint256 *pubkeyp,int32_t current_height,uint32_t *flagsp,int32_t *heightp,uint8_t value[IGUANA_MAXSCRIPTSIZE],uint8_t *key,int32_t keylen,int32_t *pendingp)
+{
+    CKVIndexValue entry; int32_t valuesize = -1;
+    if ( fKVIndex != 0 )
+    {
+        memset(pubkeyp,0,sizeof(*pubkeyp));
+        *flagsp = 0;
+        *heightp = -1;
+        if ( pblocktree->ReadKV(std::vector<unsigned char>(key,key+keylen),entry) != 0 && current_height <= entry.nExpiration && entry.vchValue.size() <= IGUANA_MAXSCRIPTSIZE )
+        {
+            *pubkeyp = entry.pubkey;
+            *flagsp = entry.nFlags;
+            *heightp = entry.nHeight;
+            if ( (valuesize= (int32_t)entry.vchValue.size()) > 0 )
+                memcpy(value,&entry.vchValue[0],valuesize);
+        }
+    } else valuesize = safecoin_kvsearch(pubkeyp,current_height,flagsp,heightp,value,key,keylen);
+    return(safecoin_kvmempool(pubkeyp,flagsp,heightp,value,valuesize,key,keylen,pendingp));
+}
+
+// live keys starting with prefix, confirmed or pending, in key order
+int32_t safecoin_kvkeys(std::vector<std::vector<uint8_t> > &keys,uint8_t *prefix,int32_t prefixlen,int32_t current_height,int32_t maxkeys)
+{
+    std::set<std::vector<uint8_t> > setKeys; std::vector<std::pair<std::vector<unsigned char>,CKVIndexValue> > vEntries; struct safecoin_kv *ptr,*tmp; struct safecoin_kvop op; uint8_t *opret; int32_t i,j,opretlen;
+    if ( fKVIndex != 0 )
+    {
+        pblocktree->ReadKVPrefix(std::vector<unsigned char>(prefix,prefix+prefixlen),current_height,maxkeys,vEntries);
+        for (i=0; i<vEntries.size(); i++)
+            setKeys.insert(vEntries[i].first);
+    }
+    else
+    {
+        portable_mutex_lock(&SAFECOIN_KV_mutex);
+        HASH_ITER(hh,SAFECOIN_KV,ptr,tmp)
+        {
+            if ( ptr->keylen >= prefixlen && memcmp(ptr->key,prefix,prefixlen) == 0 && current_height <= ptr->height + safecoin_kvduration(ptr->flags) )
+                setKeys.insert(std::vector<uint8_t>(ptr->key,ptr->key+ptr->keylen));
+        }
+        portable_mutex_unlock(&SAFECOIN_KV_mutex);
+    }
+    {
+        LOCK(mempool.cs);
+        for (CTxMemPool::indexed_transaction_set::iterator it=mempool.mapTx.begin(); it!=mempool.mapTx.end(); it++)
+        {
+            const CTransaction &tx = it->GetTx();
+            for (j=0; j<tx.vout.size(); j++)
             {
-                if ( ptr->value != 0 )
-                    free(ptr->value), ptr->value = 0;
-                if ( (ptr->valuesize= valuesize) != 0 )
-                {
-                    ptr->value = (uint8_t *)calloc(1,valuesize);
-                    memcpy(ptr->value,valueptr,valuesize);
-                }
+                if ( (opretlen= safecoin_kvopret(&opret,tx.vout[j],1,j)) < 0 || safecoin_kvparse(&op,opret,opretlen,(uint64_t)tx.vout[j].nValue) < 0 )
+                    continue;
+                if ( op.keylen >= prefixlen && memcmp(op.key,prefix,prefixlen) == 0 )
+                    setKeys.insert(std::vector<uint8_t>(op.key,op.key+op.keylen));
             }
-            /*for (i=0; i<32; i++)
-                printf("%02x",((uint8_t *)&ptr->pubkey)[i]);
-            printf(" <- ");
-            for (i=0; i<32; i++)
-                printf("%02x",((uint8_t *)&pubkey)[i]);
-            printf(" new pubkey\n");*/
-            memcpy(&ptr->pubkey,&pubkey,sizeof(ptr->pubkey));
-            ptr->height = height;
-            ptr->flags = flags | 1;
-            portable_mutex_unlock(&SAFECOIN_KV_mutex);
-        } //else printf("size mismatch %d vs %d\n",opretlen,coresize);
-    } 
+        }
+    }
+    keys.assign(setKeys.begin(),setKeys.end());
+    if ( keys.size() > maxkeys )
+        keys.resize(maxkeys);
+    return((int32_t)keys.size());
 }
 
 #endif
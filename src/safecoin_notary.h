@@ -130,21 +130,68 @@ const char *Notaries_elected[][2] =
     */
 };
 
-int32_t safecoin_electednotary(uint8_t *pubkey33,int32_t height)
+// Notaries_elected decoded once into binary form, read-only after safecoin_electedtable() first returns
+struct safecoin_notaryindex { uint8_t pubkey33[33]; int8_t notaryid; };
+struct safecoin_notarytable
+{
+    int32_t numnotaries;
+    uint8_t pubkeys[64][33];
+    uint8_t rmd160[20]; // of notary 0, the only one also recognised by its p2pkh script
+    struct safecoin_notaryindex sorted[64];
+};
+struct safecoin_notarytable Notary_table;
+pthread_once_t Notary_table_once = PTHREAD_ONCE_INIT;
+
+int safecoin_notaryindex_cmp(const void *a,const void *b)
+{
+    const struct safecoin_notaryindex *x = (const struct safecoin_notaryindex *)a,*y = (const struct safecoin_notaryindex *)b;
+    int retval;
+    if ( (retval= memcmp(x->pubkey33,y->pubkey33,33)) != 0 )
+        return(retval);
+    return(x->notaryid - y->notaryid);
+}
+
+void safecoin_notarytable_init()
 {
-    char pubkeystr[67]; int32_t i; uint8_t legacy33[33];
-    for (i=0; i<33; i++)
-        sprintf(&pubkeystr[i*2],"%02x",pubkey33[i]);
-    pubkeystr[66] = 0;
-    //printf("%s vs\n",pubkeystr);
-    for (i=0; i<sizeof(Notaries_elected)/sizeof(*Notaries_elected); i++)
+    struct safecoin_notarytable *nt = &Notary_table; int32_t i,n;
+    n = (int32_t)(sizeof(Notaries_elected)/sizeof(*Notaries_elected));
+    if ( n > 64 )
+        n = 64;
+    for (i=0; i<n; i++)
     {
-        if ( strcmp(pubkeystr,(char *)Notaries_elected[i][1]) == 0 )
-        {
-            //printf("i.%d -> elected %s\n",i,(char *)Notaries_elected[i][1]);
-            return(i);
-        }
+        decode_hex(nt->pubkeys[i],33,(char *)Notaries_elected[i][1]);
+        memcpy(nt->sorted[i].pubkey33,nt->pubkeys[i],33);
+        nt->sorted[i].notaryid = i;
+    }
+    qsort(nt->sorted,n,sizeof(*nt->sorted),safecoin_notaryindex_cmp);
+    calc_rmd160_sha256(nt->rmd160,nt->pubkeys[0],33);
+    nt->numnotaries = n;
+}
+
+const struct safecoin_notarytable *safecoin_electedtable()
+{
+    pthread_once(&Notary_table_once,safecoin_notarytable_init);
+    return(&Notary_table);
+}
+
+// lowest notaryid with this pubkey, same answer as a linear scan of Notaries_elected
+int32_t safecoin_notaryid(const struct safecoin_notarytable *nt,const uint8_t *pubkey33)
+{
+    int32_t lo = 0,hi = nt->numnotaries,mid;
+    while ( lo < hi )
+    {
+        mid = (lo + hi) >> 1;
+        if ( memcmp(nt->sorted[mid].pubkey33,pubkey33,33) < 0 )
+            lo = mid + 1;
+        else hi = mid;
     }
+    if ( lo < nt->numnotaries && memcmp(nt->sorted[lo].pubkey33,pubkey33,33) == 0 )
+        return(nt->sorted[lo].notaryid);
+    return(-1);
+}
+
+int32_t safecoin_electednotary(uint8_t *pubkey33,int32_t height)
+{
     /*if ( height < 300000 )
     {
         for (i=0; i<sizeof(Notaries_genesis)/sizeof(*Notaries_genesis); i++)
@@ -159,7 +206,7 @@ int32_t safecoin_electednotary(uint8_t *pubkey33,int32_t height)
         if ( memcmp(pubkey33,legacy33,33) == 0 )
             return(128);
     }*/
-    return(-1);
+    return(safecoin_notaryid(safecoin_electedtable(),pubkey33));
 }
 
 int32_t safecoin_ratify_threshold(int32_t height,uint64_t signedmask)
@@ -180,10 +227,9 @@ int32_t safecoin_notaries(uint8_t pubkeys[64][33],int32_t height)
     int32_t i,htind,n; uint64_t mask = 0; struct knotary_entry *kp,*tmp;
      if ( height >= 0 || ASSETCHAINS_SYMBOL[0] != 0 )                           //sc disabling
     {
-        n = (int32_t)(sizeof(Notaries_elected)/sizeof(*Notaries_elected));
-        for (i=0; i<n; i++)
-            decode_hex(pubkeys[i],33,(char *)Notaries_elected[i][1]);
-        return(n);
+        const struct safecoin_notarytable *nt = safecoin_electedtable();
+        memcpy(pubkeys,nt->pubkeys,nt->numnotaries * 33);
+        return(nt->numnotaries);
     }
     htind = height / SAFECOIN_ELECTION_GAP;
     pthread_mutex_lock(&safecoin_mutex);
@@ -263,7 +309,7 @@ int32_t safecoin_chosennotary(int32_t *notaryidp,int32_t height,uint8_t *pubkey3
     {
         if ( (*notaryidp= safecoin_electednotary(pubkey33,height)) >= 0 )
         {
-            numnotaries = (int32_t)(sizeof(Notaries_elected)/sizeof(*Notaries_elected));
+            numnotaries = safecoin_electedtable()->numnotaries;
             modval = ((height % numnotaries) == *notaryidp);
             return(modval);
         }
@@ -289,9 +335,30 @@ int32_t safecoin_chosennotary(int32_t *notaryidp,int32_t height,uint8_t *pubkey3
     return(modval);
 }
 
+// NPOINTS is kept sorted by nHeight and read without safecoin_mutex: an entry is complete before NUM_NPOINTS
+// covers it, and an array that gets replaced is kept until no reader can hold it, so a reader holding an older
+// NPOINTS still sees at least NUM_NPOINTS valid entries in it
+// retired arrays are freed by an update that finds no safecoin_notarizeddata call in progress after publishing
+// its NPOINTS, as any reader starting later loads that one
+void safecoin_npoints_retire(struct safecoin_state *sp,struct notarized_checkpoint *points)
+{
+    int32_t i;
+    if ( points != 0 )
+    {
+        sp->RETIRED_NPOINTS = (struct notarized_checkpoint **)realloc(sp->RETIRED_NPOINTS,(sp->NUM_RETIRED_NPOINTS+1) * sizeof(*sp->RETIRED_NPOINTS));
+        sp->RETIRED_NPOINTS[sp->NUM_RETIRED_NPOINTS++] = points;
+    }
+    if ( sp->NUM_RETIRED_NPOINTS > 0 && __atomic_load_n(&SAFECOIN_NPOINTS_READERS,__ATOMIC_SEQ_CST) == 0 )
+    {
+        for (i=0; i<sp->NUM_RETIRED_NPOINTS; i++)
+            free(sp->RETIRED_NPOINTS[i]);
+        sp->NUM_RETIRED_NPOINTS = 0;
+    }
+}
+
 void safecoin_notarized_update(struct safecoin_state *sp,int32_t nHeight,int32_t notarized_height,uint256 notarized_hash,uint256 notarized_desttxid)
 {
-    struct notarized_checkpoint *np;
+    struct notarized_checkpoint *np,*points,N; int32_t lo,hi,mid,num;
     if ( notarized_height > nHeight )
     {
         printf("safecoin_notarized_update REJECT notarized_height %d > %d nHeight\n",notarized_height,nHeight);
@@ -299,14 +366,45 @@ void safecoin_notarized_update(struct safecoin_state *sp,int32_t nHeight,int32_t
     }
     if ( 0 && ASSETCHAINS_SYMBOL[0] != 0 )
         printf("[%s] safecoin_notarized_update nHeight.%d notarized_height.%d\n",ASSETCHAINS_SYMBOL,nHeight,notarized_height);
+    memset(&N,0,sizeof(N));
+    N.nHeight = nHeight;
+    N.notarized_height = notarized_height;
+    N.notarized_hash = notarized_hash;
+    N.notarized_desttxid = notarized_desttxid;
     portable_mutex_lock(&safecoin_mutex);
-    sp->NPOINTS = (struct notarized_checkpoint *)realloc(sp->NPOINTS,(sp->NUM_NPOINTS+1) * sizeof(*sp->NPOINTS));
-    np = &sp->NPOINTS[sp->NUM_NPOINTS++];
-    memset(np,0,sizeof(*np));
-    np->nHeight = nHeight;
-    sp->NOTARIZED_HEIGHT = np->notarized_height = notarized_height;
-    sp->NOTARIZED_HASH = np->notarized_hash = notarized_hash;
-    sp->NOTARIZED_DESTTXID = np->notarized_desttxid = notarized_desttxid;
+    points = sp->NPOINTS;
+    num = sp->NUM_NPOINTS;
+    // after any points at the same height, a notarization seen later wins
+    for (lo=0,hi=num; lo<hi; )
+    {
+        mid = (lo + hi) >> 1;
+        if ( points[mid].nHeight <= nHeight )
+            lo = mid + 1;
+        else hi = mid;
+    }
+    if ( lo == num && num < sp->MAX_NPOINTS )
+    {
+        points[num] = N;
+        safecoin_npoints_retire(sp,0);
+    }
+    else
+    {
+        // out of order after a reorg, or full: readers may be in the old array, so build a new one
+        if ( num >= sp->MAX_NPOINTS )
+            sp->MAX_NPOINTS = (sp->MAX_NPOINTS < 64) ? 64 : (sp->MAX_NPOINTS << 1);
+        np = (struct notarized_checkpoint *)malloc(sp->MAX_NPOINTS * sizeof(*np));
+        if ( lo > 0 )
+            memcpy(np,points,lo * sizeof(*np));
+        np[lo] = N;
+        if ( lo < num )
+            memcpy(&np[lo+1],&points[lo],(num - lo) * sizeof(*np));
+        __atomic_store_n(&sp->NPOINTS,np,__ATOMIC_SEQ_CST);
+        safecoin_npoints_retire(sp,points);
+    }
+    __atomic_store_n(&sp->NUM_NPOINTS,num+1,__ATOMIC_RELEASE);
+    sp->NOTARIZED_HEIGHT = notarized_height;
+    sp->NOTARIZED_HASH = notarized_hash;
+    sp->NOTARIZED_DESTTXID = notarized_desttxid;
     portable_mutex_unlock(&safecoin_mutex);
 }
 
@@ -328,56 +426,32 @@ int32_t safecoin_notarized_height(uint256 *hashp,uint256 *txidp)
     }
 }
 
+// latest notarization recorded below nHeight, lock free so CheckBlockHeader can call it through safecoin_checkpoint
 int32_t safecoin_notarizeddata(int32_t nHeight,uint256 *notarized_hashp,uint256 *notarized_desttxidp)
 {
-    struct notarized_checkpoint *np = 0; int32_t i=0,flag = 0; char symbol[SAFECOIN_ASSETCHAIN_MAXLEN],dest[SAFECOIN_ASSETCHAIN_MAXLEN]; struct safecoin_state *sp;
+    struct notarized_checkpoint *points,*np; int32_t lo,hi,mid,num,notarized_height; char symbol[SAFECOIN_ASSETCHAIN_MAXLEN],dest[SAFECOIN_ASSETCHAIN_MAXLEN]; struct safecoin_state *sp;
     if ( (sp= safecoin_stateptr(symbol,dest)) != 0 )
     {
-        if ( sp->NUM_NPOINTS > 0 )
+        __atomic_add_fetch(&SAFECOIN_NPOINTS_READERS,1,__ATOMIC_SEQ_CST);
+        num = __atomic_load_n(&sp->NUM_NPOINTS,__ATOMIC_SEQ_CST);
+        points = __atomic_load_n(&sp->NPOINTS,__ATOMIC_SEQ_CST);
+        for (lo=0,hi=num; lo<hi; )
         {
-            flag = 0;
-            if ( sp->last_NPOINTSi < sp->NUM_NPOINTS && sp->last_NPOINTSi > 0 )
-            {
-                np = &sp->NPOINTS[sp->last_NPOINTSi-1];
-                if ( np->nHeight < nHeight )
-                {
-                    for (i=sp->last_NPOINTSi; i<sp->NUM_NPOINTS; i++)
-                    {
-                        if ( sp->NPOINTS[i].nHeight >= nHeight )
-                        {
-                            //printf("flag.1 i.%d np->ht %d [%d].ht %d >= nHeight.%d, last.%d num.%d\n",i,np->nHeight,i,sp->NPOINTS[i].nHeight,nHeight,sp->last_NPOINTSi,sp->NUM_NPOINTS);
-                            flag = 1;
-                            break;
-                        }
-                        np = &sp->NPOINTS[i];
-                        sp->last_NPOINTSi = i;
-                    }
-                }
-            }
-            if ( flag == 0 )
-            {
-                np = 0;
-                for (i=0; i<sp->NUM_NPOINTS; i++)
-                {
-                    if ( sp->NPOINTS[i].nHeight >= nHeight )
-                    {
-                        //printf("i.%d np->ht %d [%d].ht %d >= nHeight.%d\n",i,np->nHeight,i,sp->NPOINTS[i].nHeight,nHeight);
-                        break;
-                    }
-                    np = &sp->NPOINTS[i];
-                    sp->last_NPOINTSi = i;
-                }
-            }
+            mid = (lo + hi) >> 1;
+            if ( points[mid].nHeight < nHeight )
+                lo = mid + 1;
+            else hi = mid;
         }
-        if ( np != 0 )
+        if ( lo > 0 )
         {
-            //char str[65],str2[65]; printf("[%s] notarized_ht.%d\n",ASSETCHAINS_SYMBOL,np->notarized_height);
-            if ( np->nHeight >= nHeight || (i < sp->NUM_NPOINTS && np[1].nHeight < nHeight) )
-                printf("warning: flag.%d i.%d np->ht %d [1].ht %d >= nHeight.%d\n",flag,i,np->nHeight,np[1].nHeight,nHeight);
+            np = &points[lo-1];
             *notarized_hashp = np->notarized_hash;
             *notarized_desttxidp = np->notarized_desttxid;
-            return(np->notarized_height);
+            notarized_height = np->notarized_height;
+            __atomic_sub_fetch(&SAFECOIN_NPOINTS_READERS,1,__ATOMIC_SEQ_CST);
+            return(notarized_height);
         }
+        __atomic_sub_fetch(&SAFECOIN_NPOINTS_READERS,1,__ATOMIC_SEQ_CST);
     }
     memset(notarized_hashp,0,sizeof(*notarized_hashp));
     memset(notarized_desttxidp,0,sizeof(*notarized_desttxidp));
@@ -51,6 +51,7 @@ union _bits320 { uint8_t bytes[40]; uint16_t ushorts[20]; uint32_t uints[10]; ui
 typedef union _bits320 bits320;
 
 struct safecoin_kv { UT_hash_handle hh; bits256 pubkey; uint8_t *key,*value; int32_t height; uint32_t flags; uint16_t keylen,valuesize; };
+struct safecoin_kvop { uint256 pubkey,sig; uint8_t *key,*value; int32_t height,coresize; uint32_t flags; uint16_t keylen,valuesize; };
 
 struct safecoin_event_notarized { uint256 blockhash,desttxid; int32_t notarizedheight; char dest[16]; };
 struct safecoin_event_pubkeys { uint8_t num; uint8_t pubkeys[64][33]; };
@@ -67,6 +68,10 @@ struct safecoin_event
     uint8_t space[];
 };
 
+// events are carved out of these in order and handed back in reverse order on rewind
+#define SAFECOIN_EVENTCHUNK_SIZE (1 << 20)
+struct safecoin_eventchunk { struct safecoin_eventchunk *prev; uint32_t used,size; uint8_t space[]; };
+
 struct pax_transaction
 {
     UT_hash_handle hh;
@@ -87,7 +92,9 @@ struct safecoin_state
     int32_t SAVEDHEIGHT,CURRENT_HEIGHT,NOTARIZED_HEIGHT;
     uint32_t SAVEDTIMESTAMP;
     uint64_t deposited,issued,withdrawn,approved,redeemed,shorted;
-    struct notarized_checkpoint *NPOINTS; int32_t NUM_NPOINTS,last_NPOINTSi;
-    struct safecoin_event **Safecoin_events; int32_t Safecoin_numevents;
+    struct notarized_checkpoint *NPOINTS; int32_t NUM_NPOINTS,MAX_NPOINTS; // sorted by nHeight, see safecoin_notarized_update
+    struct notarized_checkpoint **RETIRED_NPOINTS; int32_t NUM_RETIRED_NPOINTS; // replaced NPOINTS arrays not freed yet
+    struct safecoin_event **Safecoin_events; int32_t Safecoin_numevents,Safecoin_maxevents;
+    struct safecoin_eventchunk *Safecoin_eventchunks;
     uint32_t RTbufs[64][3]; uint64_t RTmask;
 };
@@ -837,6 +837,23 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
+
+    // Entries without a trailing lock time are read as unknown
+    BOOST_CHECK_EQUAL(cc1.fHaveLockTime, false);
+
+    // Lock time round-trips and does not affect equality
+    CCoins cc6 = cc1;
+    cc6.nLockTime = 1491350400;
+    cc6.fHaveLockTime = true;
+    CDataStream ss6(SER_DISK, CLIENT_VERSION);
+    ss6 << cc6;
+    BOOST_CHECK_EQUAL(ss6.size(), cc6.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+    CCoins cc7;
+    ss6 >> cc7;
+    BOOST_CHECK(ss6.empty());
+    BOOST_CHECK_EQUAL(cc7.fHaveLockTime, true);
+    BOOST_CHECK_EQUAL(cc7.nLockTime, 1491350400U);
+    BOOST_CHECK(cc7 == cc1);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The Safecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+#include "test/test_bitcoin.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+typedef std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> > KVEntries;
+
+static std::vector<unsigned char> KVKey(const std::string &str)
+{
+    return std::vector<unsigned char>(str.begin(), str.end());
+}
+
+static CKVIndexValue KVValue(int nHeight, int nExpiration, const std::string &str)
+{
+    CKVIndexValue value;
+    value.nHeight = nHeight;
+    value.nExpiration = nExpiration;
+    value.nFlags = 1;
+    value.vchValue = KVKey(str);
+    return value;
+}
+
+BOOST_FIXTURE_TEST_SUITE(kvindex_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(kvindex_disconnect_restores_previous_value)
+{
+    CBlockTreeDB db(1 << 20, true);
+    std::vector<unsigned char> key = KVKey("alpha");
+    uint256 hashA = uint256S("0a");
+    uint256 hashB = uint256S("0b");
+    CKVIndexValue value;
+
+    // block A creates the key, block B updates it
+    CKVIndexUndo undoA;
+    undoA.vPrev.push_back(std::make_pair(key, CKVIndexValue()));
+    KVEntries entriesA(1, std::make_pair(key, KVValue(10, 1450, "first")));
+    BOOST_CHECK(db.WriteKVBlock(hashA, undoA, entriesA));
+
+    CKVIndexUndo undoB;
+    BOOST_CHECK(db.ReadKV(key, value));
+    undoB.vPrev.push_back(std::make_pair(key, value));
+    KVEntries entriesB(1, std::make_pair(key, KVValue(11, 1451, "second")));
+    BOOST_CHECK(db.WriteKVBlock(hashB, undoB, entriesB));
+
+    BOOST_CHECK(db.ReadKV(key, value));
+    BOOST_CHECK(value.vchValue == KVKey("second"));
+    BOOST_CHECK(db.HaveKVBlock(hashB));
+
+    // disconnecting B brings back A's value and its expiry
+    BOOST_CHECK(db.EraseKVBlock(hashB));
+    BOOST_CHECK(!db.HaveKVBlock(hashB));
+    BOOST_CHECK(db.ReadKV(key, value));
+    BOOST_CHECK(value.vchValue == KVKey("first"));
+    BOOST_CHECK_EQUAL(value.nHeight, 10);
+    BOOST_CHECK_EQUAL(value.nExpiration, 1450);
+
+    std::vector<std::vector<unsigned char> > vExpired;
+    BOOST_CHECK(db.ReadKVExpired(1451, vExpired));
+    BOOST_CHECK_EQUAL(vExpired.size(), 1);
+    BOOST_CHECK(vExpired[0] == key);
+    vExpired.clear();
+    BOOST_CHECK(db.ReadKVExpired(1450, vExpired));
+    BOOST_CHECK(vExpired.empty());
+
+    // and disconnecting A removes the key again
+    BOOST_CHECK(db.EraseKVBlock(hashA));
+    BOOST_CHECK(!db.ReadKV(key, value));
+    vExpired.clear();
+    BOOST_CHECK(db.ReadKVExpired(1451, vExpired));
+    BOOST_CHECK(vExpired.empty());
+}
+
+BOOST_AUTO_TEST_CASE(kvindex_prefix_skips_expired)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CKVIndexUndo undo;
+    KVEntries entries;
+    entries.push_back(std::make_pair(KVKey("k1"), KVValue(1, 5, "expired")));
+    entries.push_back(std::make_pair(KVKey("k2"), KVValue(1, 100, "live")));
+    entries.push_back(std::make_pair(KVKey("k3"), KVValue(1, 100, "live")));
+    entries.push_back(std::make_pair(KVKey("k4"), KVValue(1, 2, "expired")));
+    entries.push_back(std::make_pair(KVKey("x1"), KVValue(1, 100, "other")));
+    for (unsigned int i = 0; i < entries.size(); i++)
+        undo.vPrev.push_back(std::make_pair(entries[i].first, CKVIndexValue()));
+    BOOST_CHECK(db.WriteKVBlock(uint256S("0c"), undo, entries));
+
+    // expired entries are neither returned nor counted against the limit
+    KVEntries found;
+    BOOST_CHECK(db.ReadKVPrefix(KVKey("k"), 10, 2, found));
+    BOOST_CHECK_EQUAL(found.size(), 2);
+    BOOST_CHECK(found[0].first == KVKey("k2"));
+    BOOST_CHECK(found[1].first == KVKey("k3"));
+
+    found.clear();
+    BOOST_CHECK(db.ReadKVPrefix(KVKey("k"), 3, 10, found));
+    BOOST_CHECK_EQUAL(found.size(), 3);
+
+    found.clear();
+    BOOST_CHECK(db.ReadKVPrefix(KVKey("k"), 101, 10, found));
+    BOOST_CHECK(found.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
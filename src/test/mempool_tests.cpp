@@ -9,6 +9,7 @@
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <algorithm>
 #include <list>
 
 BOOST_FIXTURE_TEST_SUITE(mempool_tests, TestingSetup)
@@ -101,4 +102,243 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // A low-fee parent with a high-fee child, and an unrelated transaction
+    // whose fee rate lies between the two.
+    CMutableTransaction txParent = CMutableTransaction();
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000LL, 100, 0.0, 1));
+
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 20000LL, 200, 0.0, 1));
+
+    CMutableTransaction txOther = CMutableTransaction();
+    txOther.vin.resize(1);
+    txOther.vin[0].scriptSig = CScript() << OP_12;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_12 << OP_EQUAL;
+    txOther.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txOther.GetHash(), CTxMemPoolEntry(txOther, 5000LL, 300, 0.0, 1));
+
+    CTxMemPool::txiter parentIt = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter childIt = pool.mapTx.find(txChild.GetHash());
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 21000LL);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 21000LL);
+    BOOST_CHECK_EQUAL(childIt->GetSizeWithAncestors(), parentIt->GetTxSize() + childIt->GetTxSize());
+
+    // Mining order: the parent+child package beats txOther, txOther beats the parent alone
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator ait = pool.mapTx.get<ancestor_score>().begin();
+    BOOST_CHECK(ait->GetTx().GetHash() == txChild.GetHash()); ait++;
+    BOOST_CHECK(ait->GetTx().GetHash() == txOther.GetHash()); ait++;
+    BOOST_CHECK(ait->GetTx().GetHash() == txParent.GetHash());
+
+    // Eviction order: txOther goes first, as the child pays for the parent
+    BOOST_CHECK(pool.mapTx.get<descendant_score>().begin()->GetTx().GetHash() == txOther.GetHash());
+
+    // Entry time order
+    BOOST_CHECK(pool.mapTx.get<entry_time>().begin()->GetTx().GetHash() == txParent.GetHash());
+
+    // Prioritising the parent is reflected in the child's package
+    pool.PrioritiseTransaction(txParent.GetHash(), txParent.GetHash().ToString(), 0.0, 4000LL);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 25000LL);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 25000LL);
+
+    // Mining the parent leaves the child on its own
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 20000LL);
+    BOOST_CHECK(pool.GetMemPoolParents(childIt).empty());
+
+    // Returning the parent to the pool (as after a reorg) relinks the child
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000LL, 100, 0.0, 1));
+    parentIt = pool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 25000LL);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 0, 0.0, 1));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000LL, 0, 0.0, 1));
+
+    pool.TrimToSize(pool.DynamicMemoryUsage()); // should do nothing
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4); // should remove the lower-feerate transaction
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000LL, 0, 0.0, 1));
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_2;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 20000LL, 0, 0.0, 1));
+
+    // tx3 pays for tx2, so tx1 is now the cheapest package
+    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK(pool.exists(tx3.GetHash()));
+
+    // evicting a parent takes its descendants with it
+    std::vector<uint256> vNoSpendsRemaining;
+    pool.TrimToSize(1, &vNoSpendsRemaining);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK(std::find(vNoSpendsRemaining.begin(), vNoSpendsRemaining.end(), tx2.vin[0].prevout.hash) != vNoSpendsRemaining.end());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolExpireTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction txOld = CMutableTransaction();
+    txOld.vin.resize(1);
+    txOld.vin[0].scriptSig = CScript() << OP_1;
+    txOld.vout.resize(1);
+    txOld.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    txOld.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txOld.GetHash(), CTxMemPoolEntry(txOld, 10000LL, 100, 0.0, 1));
+
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txOld.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_1;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    txChild.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 10000LL, 300, 0.0, 1));
+
+    CMutableTransaction txNew = CMutableTransaction();
+    txNew.vin.resize(1);
+    txNew.vin[0].scriptSig = CScript() << OP_2;
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    txNew.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txNew.GetHash(), CTxMemPoolEntry(txNew, 10000LL, 300, 0.0, 1));
+
+    BOOST_CHECK_EQUAL(pool.Expire(50), 0);
+    // the child is younger than the cutoff but goes with its parent
+    BOOST_CHECK_EQUAL(pool.Expire(200), 2);
+    BOOST_CHECK(!pool.exists(txChild.GetHash()));
+    BOOST_CHECK(pool.exists(txNew.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorLimitTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // a chain of three, each spending the previous one
+    std::vector<CMutableTransaction> chain(4);
+    for (unsigned int i = 0; i < chain.size(); i++) {
+        chain[i].vin.resize(1);
+        chain[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0)
+            chain[i].vin[0].prevout = COutPoint(chain[i-1].GetHash(), 0);
+        chain[i].vout.resize(1);
+        chain[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        chain[i].vout[0].nValue = (10 - i) * COIN;
+    }
+    for (unsigned int i = 0; i < 3; i++)
+        pool.addUnchecked(chain[i].GetHash(), CTxMemPoolEntry(chain[i], 1000LL, 0, 0.0, 1));
+
+    CTxMemPoolEntry entry(chain[3], 1000LL, 0, 0.0, 1);
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 1000000, 4, 1000000, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3);
+
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry, setAncestors, 3, 1000000, 4, 1000000, errString));
+    setAncestors.clear();
+    // the root would get a fourth descendant
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 1000000, 3, 1000000, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 1000000, 4, entry.GetTxSize() * 3, errString));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolRollingFeeTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    SetMockTime(42);
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 0, 0.0, 1));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    CTxMemPoolEntry entry2(tx2, 5000LL, 0, 0.0, 1);
+    pool.addUnchecked(tx2.GetHash(), entry2);
+
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // evicting tx2 raises the floor to its fee rate plus the relay fee
+    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4);
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+    CAmount nFloor = CFeeRate(5000LL, entry2.GetTxSize()).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nFloor);
+
+    // no decay until a block has been connected
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nFloor);
+
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts, false);
+    SetMockTime(42 + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nFloor / 2);
+
+    // and it drops to zero once below half the relay fee
+    SetMockTime(42 + 20 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -23,6 +23,13 @@ static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_KV = 'K';
+static const char DB_KVEXPIRY = 'e';
+static const char DB_KVUNDO = 'k';
+static const char DB_ADDRESSINDEX = 'd';
+static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_SPENTINDEX = 'p';
+static const char DB_TIMESTAMPINDEX = 'S';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_BEST_ANCHOR = 'a';
@@ -257,6 +264,274 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+// kv index keys hold the raw key bytes, unprefixed by a length, so that they sort and can be prefix scanned
+
+static std::vector<unsigned char> KVIndexKey(const std::vector<unsigned char> &key) {
+    std::vector<unsigned char> k(1, DB_KV);
+    k.insert(k.end(), key.begin(), key.end());
+    return k;
+}
+
+// expiry heights are stored big endian so the entries sort by height
+static std::vector<unsigned char> KVExpiryKey(int nExpiration, const std::vector<unsigned char> &key) {
+    uint32_t nBigEndian = htobe32(nExpiration < 0 ? 0 : (uint32_t)nExpiration);
+    std::vector<unsigned char> k(1, DB_KVEXPIRY);
+    k.insert(k.end(), (unsigned char *)&nBigEndian, (unsigned char *)&nBigEndian + sizeof(nBigEndian));
+    k.insert(k.end(), key.begin(), key.end());
+    return k;
+}
+
+bool CBlockTreeDB::ReadKV(const std::vector<unsigned char> &key, CKVIndexValue &value) {
+    std::vector<unsigned char> k = KVIndexKey(key);
+    return Read(CFlatData(k), value);
+}
+
+bool CBlockTreeDB::ReadKVPrefix(const std::vector<unsigned char> &prefix, int nHeight, size_t nMax, std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> > &vEntries) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    std::vector<unsigned char> k = KVIndexKey(prefix);
+
+    pcursor->Seek(leveldb::Slice((const char *)&k[0], k.size()));
+    while (pcursor->Valid() && vEntries.size() < nMax) {
+        boost::this_thread::interruption_point();
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() < k.size() || memcmp(slKey.data(), &k[0], k.size()) != 0)
+            break;
+        try {
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CKVIndexValue value;
+            ssValue >> value;
+            // expired entries stay until the next block sweeps them, and don't count towards nMax
+            if (nHeight <= value.nExpiration)
+                vEntries.push_back(std::make_pair(std::vector<unsigned char>(slKey.data()+1, slKey.data()+slKey.size()), value));
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadKVExpired(int nHeight, std::vector<std::vector<unsigned char> > &vKeys) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    std::vector<unsigned char> kStart = KVExpiryKey(0, std::vector<unsigned char>());
+    std::vector<unsigned char> kEnd = KVExpiryKey(nHeight, std::vector<unsigned char>());
+
+    // everything strictly below the first key at nHeight has expired
+    pcursor->Seek(leveldb::Slice((const char *)&kStart[0], kStart.size()));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() < kEnd.size() || slKey.data()[0] != DB_KVEXPIRY || memcmp(slKey.data(), &kEnd[0], kEnd.size()) >= 0)
+            break;
+        vKeys.push_back(std::vector<unsigned char>(slKey.data()+kEnd.size(), slKey.data()+slKey.size()));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::HaveKVBlock(const uint256 &hashBlock) {
+    return Exists(make_pair(DB_KVUNDO, hashBlock));
+}
+
+bool CBlockTreeDB::WriteKVBlock(const uint256 &hashBlock, const CKVIndexUndo &undo, const std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> > &vEntries) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> >::const_iterator it=undo.vPrev.begin(); it!=undo.vPrev.end(); it++) {
+        if (!it->second.IsNull()) {
+            std::vector<unsigned char> k = KVExpiryKey(it->second.nExpiration, it->first);
+            batch.Erase(CFlatData(k));
+        }
+    }
+    for (std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> >::const_iterator it=vEntries.begin(); it!=vEntries.end(); it++) {
+        std::vector<unsigned char> k = KVIndexKey(it->first);
+        if (it->second.IsNull()) {
+            batch.Erase(CFlatData(k));
+        } else {
+            std::vector<unsigned char> kExpiry = KVExpiryKey(it->second.nExpiration, it->first);
+            batch.Write(CFlatData(k), it->second);
+            batch.Write(CFlatData(kExpiry), '1');
+        }
+    }
+    batch.Write(make_pair(DB_KVUNDO, hashBlock), undo);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseKVBlock(const uint256 &hashBlock) {
+    CKVIndexUndo undo;
+    if (!Read(make_pair(DB_KVUNDO, hashBlock), undo))
+        return true; // never connected with -kvindex, nothing to take back
+
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> >::const_iterator it=undo.vPrev.begin(); it!=undo.vPrev.end(); it++) {
+        std::vector<unsigned char> k = KVIndexKey(it->first);
+        CKVIndexValue current;
+        if (Read(CFlatData(k), current)) {
+            std::vector<unsigned char> kExpiry = KVExpiryKey(current.nExpiration, it->first);
+            batch.Erase(CFlatData(kExpiry));
+        }
+        if (it->second.IsNull()) {
+            batch.Erase(CFlatData(k));
+        } else {
+            std::vector<unsigned char> kExpiry = KVExpiryKey(it->second.nExpiration, it->first);
+            batch.Write(CFlatData(k), it->second);
+            batch.Write(CFlatData(kExpiry), '1');
+        }
+    }
+    batch.Erase(make_pair(DB_KVUNDO, hashBlock));
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value) {
+    return Read(make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+        }
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
+    // applied in order, so an output created and spent within one block ends up erased
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+        }
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(const uint160 &addressHash, int type, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressUnspentKey indexKey;
+            ssKey >> chType;
+            ssKey >> indexKey;
+            if (chType != DB_ADDRESSUNSPENTINDEX || indexKey.type != type || indexKey.hashBytes != addressHash)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue nValue;
+            ssValue >> nValue;
+            vect.push_back(make_pair(indexKey, nValue));
+            pcursor->Next();
+        } catch (const std::exception& e) {
+            // a shorter key of another table past the end of ours
+            break;
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(const uint160 &addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    if (start > 0 && end > 0) {
+        ssKeySet << make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start));
+    } else {
+        ssKeySet << make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash));
+    }
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressIndexKey indexKey;
+            ssKey >> chType;
+            ssKey >> indexKey;
+            if (chType != DB_ADDRESSINDEX || indexKey.type != type || indexKey.hashBytes != addressHash)
+                break;
+            if (end > 0 && indexKey.blockHeight > end)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAmount nValue;
+            ssValue >> nValue;
+            addressIndex.push_back(make_pair(indexKey, nValue));
+            pcursor->Next();
+        } catch (const std::exception& e) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
+    CLevelDBBatch batch;
+    batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), '1');
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseTimestampIndex(const CTimestampIndexKey &timestampIndex) {
+    CLevelDBBatch batch;
+    batch.Erase(make_pair(DB_TIMESTAMPINDEX, timestampIndex));
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low, std::vector<uint256> &hashes) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CTimestampIndexKey indexKey;
+            ssKey >> chType;
+            ssKey >> indexKey;
+            if (chType != DB_TIMESTAMPINDEX || indexKey.timestamp >= high)
+                break;
+            hashes.push_back(indexKey.blockHash);
+            pcursor->Next();
+        } catch (const std::exception& e) {
+            break;
+        }
+    }
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
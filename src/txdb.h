@@ -6,8 +6,11 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
 #include "coins.h"
 #include "leveldbwrapper.h"
+#include "spentindex.h"
+#include "timestampindex.h"
 
 #include <map>
 #include <string>
@@ -26,6 +29,54 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
+/** A live entry of the on-chain key/value store, as kept by -kvindex */
+struct CKVIndexValue
+{
+    uint256 pubkey;       // owner, null if anyone may update it
+    int32_t nHeight;      // height claimed by the last update, -1 for an absent key
+    int32_t nExpiration;  // last height at which the entry is still live
+    uint32_t nFlags;
+    std::vector<unsigned char> vchValue;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(pubkey);
+        READWRITE(nHeight);
+        READWRITE(nExpiration);
+        READWRITE(nFlags);
+        READWRITE(vchValue);
+    }
+
+    CKVIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        pubkey.SetNull();
+        nHeight = -1;
+        nExpiration = -1;
+        nFlags = 0;
+        vchValue.clear();
+    }
+
+    bool IsNull() const { return nHeight < 0; }
+};
+
+/** State of every key a block touched, before the block, so it can be disconnected */
+struct CKVIndexUndo
+{
+    std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> > vPrev;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(vPrev);
+    }
+};
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
@@ -64,6 +115,23 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadKV(const std::vector<unsigned char> &key, CKVIndexValue &value);
+    //! the first nMax entries starting with prefix that are still live at nHeight, in key order
+    bool ReadKVPrefix(const std::vector<unsigned char> &prefix, int nHeight, size_t nMax, std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> > &vEntries);
+    bool ReadKVExpired(int nHeight, std::vector<std::vector<unsigned char> > &vKeys);
+    bool HaveKVBlock(const uint256 &hashBlock);
+    bool WriteKVBlock(const uint256 &hashBlock, const CKVIndexUndo &undo, const std::vector<std::pair<std::vector<unsigned char>, CKVIndexValue> > &vEntries);
+    bool EraseKVBlock(const uint256 &hashBlock);
+    bool ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+    bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    bool ReadAddressUnspentIndex(const uint160 &addressHash, int type, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool ReadAddressIndex(const uint160 &addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start = 0, int end = 0);
+    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
+    bool EraseTimestampIndex(const CTimestampIndexKey &timestampIndex);
+    bool ReadTimestampIndex(unsigned int high, unsigned int low, std::vector<uint256> &hashes);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
@@ -7,12 +7,19 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
+#include "addressindex.h"
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
+#include "spentindex.h"
 #include "sync.h"
 
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -32,6 +39,13 @@ static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 /**
  * CTxMemPool stores these:
+ *
+ * Besides the transaction itself, each entry tracks the in-mempool packages
+ * it belongs to: the totals over itself plus all of its in-mempool
+ * descendants (which must be evicted with it), and over itself plus all of
+ * its in-mempool ancestors (which must be mined before it). These are kept
+ * up to date by CTxMemPool as transactions are added and removed, so that the
+ * pool's indexes can be ordered by them.
  */
 class CTxMemPoolEntry
 {
@@ -45,6 +59,15 @@ private:
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
+    int64_t feeDelta; //! Fee delta set by prioritisetransaction
+
+    uint64_t nCountWithDescendants; //! number of in-mempool descendants, including this one
+    uint64_t nSizeWithDescendants; //! ... and their total size
+    CAmount nModFeesWithDescendants; //! ... and their total modified fees
+
+    uint64_t nCountWithAncestors; //! number of in-mempool ancestors, including this one
+    uint64_t nSizeWithAncestors; //! ... and their total size
+    CAmount nModFeesWithAncestors; //! ... and their total modified fees
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -55,13 +78,165 @@ public:
     const CTransaction& GetTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
     bool WasClearAtEntry() const { return hadNoDependencies; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+
+    // Adjusts the package totals by the given deltas
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    // Replaces the fee delta, adjusting the package totals to match
+    void UpdateFeeDelta(int64_t feeDelta);
+};
+
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_fee_delta
+{
+    update_fee_delta(int64_t _feeDelta) : feeDelta(_feeDelta) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    int64_t feeDelta;
+};
+
+// extracts a CTxMemPoolEntry's transaction hash
+struct mempoolentry_txid
+{
+    typedef uint256 result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+/**
+ * Sort an entry by max(fee rate of the entry's tx, fee rate of the entry
+ * together with all its descendants). The entry that sorts first is the
+ * cheapest to evict.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aFees = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bFees = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+
+        if (f1 == f2) {
+            if (a.GetTime() != b.GetTime())
+                return a.GetTime() > b.GetTime();
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return f1 < f2;
+    }
+
+    // Whether the descendant package pays a better fee rate than the entry alone
+    bool UseDescendantScore(const CTxMemPoolEntry& a) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/** Sort by fee rate of the entry's tx alone, highest first. */
+class CompareTxMemPoolEntryByScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
+        double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
+        if (f1 == f2)
+            return b.GetTx().GetHash() < a.GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+/** Sort by time of entry into the mempool, oldest first. */
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+/**
+ * Sort by fee rate of the entry together with all its ancestors, highest
+ * first. This is the order in which packages are worth mining.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetModFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
 };
 
+// Multi_index tag names
+struct descendant_score {};
+struct mining_score {};
+struct entry_time {};
+struct ancestor_score {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -86,7 +261,17 @@ public:
  * (or created by the local node), but not all transactions seen
  * are added to the pool: if a new transaction double-spends
  * an input of a transaction in the pool, it is dropped,
- * as are non-standard transactions.
+ * as are non-standard transactions. *
+ * mapTx is a boost::multi_index that sorts the mempool on 5 criteria:
+ * - transaction hash
+ * - descendant package fee rate (used for eviction, see TrimToSize)
+ * - transaction fee rate
+ * - time in mempool (used for expiry)
+ * - ancestor package fee rate (used for block assembly)
+ *
+ * The in-mempool parents and children of every entry are kept in mapLinks,
+ * and the package totals of the entries are updated incrementally through
+ * them whenever a transaction is added, removed or prioritised.
  */
 class CTxMemPool
 {
@@ -98,9 +283,91 @@ private:
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
 
+    CFeeRate minReasonableRelayFee;
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    void trackPackageRemoved(const CFeeRate& rate);
+
 public:
+
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // hashed by txid
+            boost::multi_index::hashed_unique<mempoolentry_txid, CCoinsKeyHasher>,
+            // sorted by descendant package fee rate
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore
+            >,
+            // sorted by fee rate
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<mining_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByScore
+            >,
+            // sorted by entry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime
+            >,
+            // sorted by ancestor package fee rate
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee
+            >
+        >
+    > indexed_transaction_set;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+    /** Add or subtract entry's size and fee to the descendant totals of setAncestors. */
+    void UpdateAncestorsOf(bool add, txiter entry, const setEntries &setAncestors);
+    /** Recompute the ancestor and descendant totals of an entry from its links. */
+    void RecalculateAncestorState(txiter entry);
+    void RecalculateDescendantState(txiter entry);
+    /** Fix up package totals and links for the entries about to be removed. */
+    void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants);
+    /** Remove a single entry and its index/link bookkeeping, without touching other entries. */
+    void removeUnchecked(txiter entry);
+
+    /** Address deltas and spends of the pool, for -addressindex and -spentindex, and what each tx put there */
+    typedef std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> addressDeltaMap;
+    addressDeltaMap mapAddress;
+    typedef std::map<uint256, std::vector<CMempoolAddressDeltaKey> > addressDeltaMapInserted;
+    addressDeltaMapInserted mapAddressInserted;
+    typedef std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpentIndex;
+    mapSpentIndex mapSpent;
+    typedef std::map<uint256, std::vector<CSpentIndexKey> > mapSpentIndexInserted;
+    mapSpentIndexInserted mapSpentInserted;
+
+public:
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, const CTransaction*> mapNullifiers;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
@@ -125,6 +392,65 @@ public:
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
+
+    /** Index an accepted entry by address and by the outputs it spends; view must hold its inputs. */
+    void addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
+    bool getAddressIndex(const std::vector<std::pair<uint160, int> > &addresses,
+                         std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > &results);
+    void removeAddressIndex(const uint256 &txhash);
+    void addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
+    bool getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    void removeSpentIndex(const uint256 &txhash);
+
+    /**
+     * Remove a set of transactions from the mempool. All descendants of a
+     * removed transaction must either be in the set too, or updateDescendants
+     * must be set (only valid when the set was just mined).
+     */
+    void RemoveStaged(setEntries &stage, bool updateDescendants);
+
+    /** Collect entry and all in-pool descendants of it into setDescendants. */
+    void CalculateDescendants(txiter entry, setEntries &setDescendants) const;
+
+    /** Collect all in-pool ancestors of entry, not including entry itself, into setAncestors. */
+    void CalculateMemPoolAncestors(txiter entry, setEntries &setAncestors) const;
+
+    /**
+     * Collect the in-pool ancestors of a transaction that is not in the pool
+     * yet into setAncestors. Fails with errString if adding it would give it
+     * more than limitAncestorCount/limitAncestorSize in ancestors (counting
+     * itself), or push any ancestor past limitDescendantCount/limitDescendantSize.
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors,
+                                   uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                   uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                   std::string &errString) const;
+
+    const setEntries & GetMemPoolParents(txiter entry) const;
+    const setEntries & GetMemPoolChildren(txiter entry) const;
+
+    /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
+    int Expire(int64_t time);
+
+    /**
+     * Remove transactions from the mempool until its dynamic size is <= sizelimit.
+     * Transactions are evicted by ascending fee rate, where a transaction is credited
+     * with the fee rate of itself plus its descendants if that is higher, and always
+     * together with their descendants.
+     * pvNoSpendsRemaining, if set, will be populated with the list of transactions
+     * which are not in mempool which no longer have any spends in this mempool.
+     */
+    void TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining = NULL);
+
+    /**
+     * The minimum fee to get into the mempool, which may itself not be enough
+     * for larger-sized transactions. Raised to the fee rate of the packages
+     * TrimToSize evicts, and decays back with a half-life of
+     * ROLLING_FEE_HALFLIFE (faster while the pool is well below sizelimit)
+     * once a block has been connected since the last raise.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
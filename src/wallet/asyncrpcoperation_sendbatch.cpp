@@ -0,0 +1,432 @@
+// Copyright (c) 2016 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "asyncrpcoperation_sendbatch.h"
+#include "amount.h"
+#include "consensus/consensus.h"
+#include "init.h"
+#include "main.h"
+#include "rpcprotocol.h"
+#include "rpcserver.h"
+#include "script/sign.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "wallet.h"
+#include "walletdb.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+// Estimated serialized size of a transaction without its inputs and outputs
+#define SENDBATCH_TX_BASE_SIZE      16
+
+extern int32_t SAFECOIN_EXCHANGEWALLET;
+extern int32_t USE_EXTERNAL_PUBKEY;
+extern std::string NOTARY_PUBKEY;
+
+AsyncRPCOperation_sendbatch::AsyncRPCOperation_sendbatch(
+        std::vector<CRecipient> recipients,
+        int minDepth,
+        int maxOutputs,
+        UniValue contextInfo) :
+        contextinfo_(contextInfo), recipients_(recipients), mindepth_(minDepth), maxoutputs_(maxOutputs),
+        planned_(0), signed_(0), committed_(0)
+{
+    if (minDepth < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Minconf cannot be negative");
+    }
+
+    if (recipients.size() == 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "No recipients");
+    }
+
+    if (maxOutputs < 1) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Maximum outputs per transaction must be positive");
+    }
+
+    LogPrint("zrpc", "%s: sendbatch initialized (recipients=%d)\n", getId(), recipients.size());
+}
+
+AsyncRPCOperation_sendbatch::~AsyncRPCOperation_sendbatch() {
+}
+
+void AsyncRPCOperation_sendbatch::main() {
+    if (isCancelled())
+        return;
+
+    set_state(OperationStatus::EXECUTING);
+    start_execution_clock();
+
+    bool success = false;
+
+    try {
+        success = main_impl();
+    } catch (const UniValue& objError) {
+        int code = find_value(objError, "code").get_int();
+        std::string message = find_value(objError, "message").get_str();
+        set_error_code(code);
+        set_error_message(message);
+    } catch (const runtime_error& e) {
+        set_error_code(-1);
+        set_error_message("runtime error: " + string(e.what()));
+    } catch (const logic_error& e) {
+        set_error_code(-1);
+        set_error_message("logic error: " + string(e.what()));
+    } catch (const exception& e) {
+        set_error_code(-1);
+        set_error_message("general exception: " + string(e.what()));
+    } catch (...) {
+        set_error_code(-2);
+        set_error_message("unknown error");
+    }
+
+    // Coins of transactions that were not committed become spendable again
+    unlock_inputs();
+
+    stop_execution_clock();
+
+    if (success) {
+        set_state(OperationStatus::SUCCESS);
+    } else {
+        set_state(OperationStatus::FAILED);
+    }
+
+    std::string s = strprintf("%s: sendbatch finished (status=%s", getId(), getStateAsString());
+    if (success) {
+        s += strprintf(", transactions=%d)\n", txs_.size());
+    } else {
+        s += strprintf(", error=%s)\n", getErrorMessage());
+    }
+    LogPrintf("%s",s);
+}
+
+bool AsyncRPCOperation_sendbatch::main_impl() {
+    plan_transactions();
+    if (isCancelled()) {
+        return false;
+    }
+    sign_transactions();
+    if (isCancelled()) {
+        return false;
+    }
+    set_result(commit_transactions());
+    return true;
+}
+
+/**
+ * Selects the coins for every transaction of the batch in one pass over the
+ * wallet's available coins, largest first. Once those run out, transactions
+ * spend the change of earlier batch transactions, largest first, so that a
+ * few large coins can fund the whole batch. The selected coins are locked so
+ * that other spends cannot pick them while the batch is being signed.
+ */
+void AsyncRPCOperation_sendbatch::plan_transactions() {
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    EnsureWalletIsUnlocked();
+
+    std::vector<COutput> vecOutputs;
+    pwalletMain->AvailableCoins(vecOutputs, true, NULL, false, false);
+
+    std::vector<SendBatchInput> coins;
+    for (const COutput& out : vecOutputs) {
+        if (!out.fSpendable || out.nDepth < mindepth_) {
+            continue;
+        }
+        const CTxOut& txout = out.tx->vout[out.i];
+        SendBatchInput input;
+        input.outpoint = COutPoint(out.tx->GetHash(), out.i);
+        input.scriptPubKey = txout.scriptPubKey;
+        input.nValue = txout.nValue;
+        input.nInterest = SAFECOIN_EXCHANGEWALLET == 0 ? (CAmount)txout.interest : 0;
+        coins.push_back(input);
+    }
+    std::sort(coins.begin(), coins.end(), [](const SendBatchInput& a, const SendBatchInput& b) {
+        return a.nValue + a.nInterest > b.nValue + b.nInterest;
+    });
+
+    size_t nextCoin = 0;
+    std::vector<SendBatchInput> changes;    // change of planned txs not spent by a later one yet
+    uint32_t nLockTime = (uint32_t)chainActive.Tip()->nTime + 1;
+    for (size_t begin = 0; begin < recipients_.size(); begin += maxoutputs_) {
+        size_t end = std::min(recipients_.size(), begin + maxoutputs_);
+
+        SendBatchTx btx;
+        btx.recipients.assign(recipients_.begin() + begin, recipients_.begin() + end);
+        CAmount nValueOut = 0;
+        for (const CRecipient& recipient : btx.recipients) {
+            nValueOut += recipient.nAmount;
+        }
+
+        // Add inputs until they cover the outputs and the fee for the
+        // transaction's size, including a change output
+        CAmount nValueIn = 0;
+        size_t nOutputs = btx.recipients.size() + 1;
+        while (true) {
+            size_t nBytes = SENDBATCH_TX_BASE_SIZE +
+                            CTXIN_SPEND_DUST_SIZE * btx.inputs.size() +
+                            CTXOUT_REGULAR_SIZE * nOutputs;
+            if (nBytes >= MAX_TX_SIZE) {
+                throw JSONRPCError(RPC_WALLET_ERROR, strprintf(
+                    "Transaction %d would exceed %d bytes, lower the maximum outputs per transaction or consolidate the wallet's coins",
+                    txs_.size(), MAX_TX_SIZE));
+            }
+            btx.nFee = std::max(CWallet::GetMinimumFee(nBytes, nTxConfirmTarget, mempool), (CAmount)5000);
+            if (!btx.inputs.empty() && nValueIn >= nValueOut + btx.nFee) {
+                break;
+            }
+            if (nextCoin < coins.size()) {
+                btx.inputs.push_back(coins[nextCoin++]);
+            } else if (!changes.empty()) {
+                std::vector<SendBatchInput>::iterator it = std::max_element(changes.begin(), changes.end(),
+                    [](const SendBatchInput& a, const SendBatchInput& b) { return a.nValue < b.nValue; });
+                btx.inputs.push_back(*it);
+                changes.erase(it);
+            } else {
+                throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, strprintf(
+                    "Insufficient funds, %d of %d recipients could be funded",
+                    begin, recipients_.size()));
+            }
+            nValueIn += btx.inputs.back().nValue + btx.inputs.back().nInterest;
+        }
+
+        CMutableTransaction& mtx = btx.mtx;
+        mtx.nLockTime = nLockTime;
+        for (const SendBatchInput& input : btx.inputs) {
+            mtx.vin.push_back(CTxIn(input.outpoint, CScript(), std::numeric_limits<unsigned int>::max()-1));
+        }
+        for (const CRecipient& recipient : btx.recipients) {
+            mtx.vout.push_back(CTxOut(recipient.nAmount, recipient.scriptPubKey));
+        }
+
+        // Never create dust change; leave it to the fee instead
+        CAmount nChange = nValueIn - nValueOut - btx.nFee;
+        CScript scriptChange;
+        if (USE_EXTERNAL_PUBKEY == 0) {
+            btx.reservekey.reset(new CReserveKey(pwalletMain));
+            CPubKey vchPubKey;
+            if (!btx.reservekey->GetReservedKey(vchPubKey)) {
+                throw JSONRPCError(RPC_WALLET_KEYPOOL_RAN_OUT, "Error: Keypool ran out, please call keypoolrefill first");
+            }
+            scriptChange = GetScriptForDestination(vchPubKey.GetID());
+        } else {
+            scriptChange = CScript() << ParseHex(NOTARY_PUBKEY) << OP_CHECKSIG;
+        }
+        CTxOut change(nChange, scriptChange);
+        if (change.IsDust(::minRelayTxFee)) {
+            btx.nFee += nChange;
+            if (btx.reservekey) {
+                btx.reservekey->ReturnKey();
+                btx.reservekey.reset();
+            }
+        } else {
+            SendBatchInput input;
+            input.outpoint = COutPoint(uint256(), mtx.vout.size());
+            input.scriptPubKey = scriptChange;
+            input.nValue = nChange;
+            input.nInterest = 0;
+            input.nChangeOf = txs_.size();
+            changes.push_back(input);
+            mtx.vout.push_back(change);
+        }
+
+        for (SendBatchInput& input : btx.inputs) {
+            if (input.nChangeOf < 0) {
+                pwalletMain->LockCoin(input.outpoint);
+            }
+        }
+        txs_.push_back(btx);
+        planned_ = txs_.size();
+    }
+}
+
+void AsyncRPCOperation_sendbatch::sign_range(const std::vector<size_t>* indexes, size_t begin, size_t end, std::atomic<bool>* failed) {
+    for (size_t k = begin; k < end && !*failed; k++) {
+        size_t i = (*indexes)[k];
+        CMutableTransaction& mtx = txs_[i].mtx;
+        // The transactions whose change this one spends are signed already
+        for (size_t nIn = 0; nIn < mtx.vin.size(); nIn++) {
+            SendBatchInput& input = txs_[i].inputs[nIn];
+            if (input.nChangeOf >= 0) {
+                input.outpoint.hash = txs_[input.nChangeOf].mtx.GetHash();
+                mtx.vin[nIn].prevout = input.outpoint;
+            }
+        }
+        const CTransaction txConst(mtx);
+        for (size_t nIn = 0; nIn < mtx.vin.size(); nIn++) {
+            const CScript& scriptPubKey = txs_[i].inputs[nIn].scriptPubKey;
+            if (!ProduceSignature(TransactionSignatureCreator(pwalletMain, &txConst, nIn, SIGHASH_ALL),
+                                  scriptPubKey, mtx.vin[nIn].scriptSig)) {
+                *failed = true;
+                return;
+            }
+        }
+        signed_++;
+    }
+}
+
+/**
+ * Signs the batch transactions on one thread per core. A transaction can
+ * only be signed once the txids of the transactions whose change it spends
+ * are known, so they are signed in rounds by chaining depth. Signing only
+ * reads the keystore, which has its own lock, so neither cs_main nor
+ * cs_wallet is held meanwhile.
+ */
+void AsyncRPCOperation_sendbatch::sign_transactions() {
+    std::vector<std::vector<size_t>> rounds;
+    std::vector<size_t> depth(txs_.size(), 0);
+    for (size_t i = 0; i < txs_.size(); i++) {
+        for (const SendBatchInput& input : txs_[i].inputs) {
+            if (input.nChangeOf >= 0) {
+                depth[i] = std::max(depth[i], depth[input.nChangeOf] + 1);
+            }
+        }
+        if (rounds.size() <= depth[i]) {
+            rounds.resize(depth[i] + 1);
+        }
+        rounds[depth[i]].push_back(i);
+    }
+
+    std::atomic<bool> failed(false);
+    for (const std::vector<size_t>& round : rounds) {
+        size_t nThreads = std::max(1u, boost::thread::hardware_concurrency());
+        nThreads = std::min(nThreads, round.size());
+        size_t nPerThread = (round.size() + nThreads - 1) / nThreads;
+
+        boost::thread_group threads;
+        for (size_t begin = 0; begin < round.size(); begin += nPerThread) {
+            size_t end = std::min(round.size(), begin + nPerThread);
+            threads.create_thread(boost::bind(&AsyncRPCOperation_sendbatch::sign_range, this, &round, begin, end, &failed));
+        }
+        threads.join_all();
+        if (failed) {
+            break;
+        }
+    }
+
+    if (failed) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "Signing transaction failed");
+    }
+}
+
+/**
+ * Adds all the batch transactions to the wallet within one database
+ * transaction, then relays them.
+ */
+UniValue AsyncRPCOperation_sendbatch::commit_transactions() {
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    std::vector<CWalletTx> wtxs;
+    for (const SendBatchTx& btx : txs_) {
+        CWalletTx wtx(pwalletMain, CTransaction(btx.mtx));
+        wtx.fTimeReceivedIsTxTime = true;
+        wtx.fFromMe = true;
+        wtxs.push_back(wtx);
+    }
+
+    {
+        std::unique_ptr<CWalletDB> pwalletdb;
+        if (pwalletMain->fFileBacked) {
+            pwalletdb.reset(new CWalletDB(pwalletMain->strWalletFile, "r+"));
+            pwalletdb->TxnBegin();
+        }
+        bool fWritten = true;
+        size_t nAdded = 0;
+        while (fWritten && nAdded < wtxs.size()) {
+            // A transaction whose write fails is in memory all the same
+            fWritten = pwalletMain->AddToWallet(wtxs[nAdded], false, pwalletdb.get());
+            for (const CTxIn& txin : wtxs[nAdded].vin) {
+                CWalletTx &coin = pwalletMain->mapWallet[txin.prevout.hash];
+                coin.BindWallet(pwalletMain);
+                pwalletMain->NotifyTransactionChanged(pwalletMain, coin.GetHash(), CT_UPDATED);
+            }
+            nAdded++;
+        }
+        if (fWritten && pwalletdb && !pwalletdb->TxnCommit()) {
+            fWritten = false;
+        }
+        if (!fWritten) {
+            // Nothing reached the database, so take the transactions back
+            // out of memory as well before any is relayed; their change keys
+            // go back to the pool
+            if (pwalletdb) {
+                pwalletdb->TxnAbort();
+                pwalletdb.reset();
+            }
+            for (size_t i = nAdded; i-- > 0; ) {
+                pwalletMain->EraseFromWallet(wtxs[i].GetHash());
+            }
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error: The batch transactions could not be written to the wallet database");
+        }
+        for (SendBatchTx& btx : txs_) {
+            if (btx.reservekey) {
+                btx.reservekey->KeepKey();
+            }
+        }
+    }
+
+    UniValue txids(UniValue::VARR);
+    UniValue rejected(UniValue::VARR);
+    CAmount nFees = 0;
+    for (size_t i = 0; i < wtxs.size(); i++) {
+        CWalletTx& wtx = pwalletMain->mapWallet[wtxs[i].GetHash()];
+        pwalletMain->mapRequestCount[wtx.GetHash()] = 0;
+        if (pwalletMain->GetBroadcastTransactions()) {
+            if (!wtx.AcceptToMemoryPool(false)) {
+                // Recorded in the wallet already, like CommitTransaction
+                LogPrintf("%s: sendbatch transaction %s not accepted to mempool\n", getId(), wtx.GetHash().ToString());
+                rejected.push_back(wtx.GetHash().ToString());
+            } else {
+                wtx.RelayWalletTransaction();
+            }
+        }
+        for (SendBatchInput& input : txs_[i].inputs) {
+            pwalletMain->UnlockCoin(input.outpoint);
+        }
+        txids.push_back(wtx.GetHash().ToString());
+        nFees += txs_[i].nFee;
+        committed_++;
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("txids", txids));
+    obj.push_back(Pair("recipients", (uint64_t)recipients_.size()));
+    obj.push_back(Pair("fees", ValueFromAmount(nFees)));
+    if (!rejected.empty()) {
+        obj.push_back(Pair("rejected", rejected));
+    }
+    return obj;
+}
+
+void AsyncRPCOperation_sendbatch::unlock_inputs() {
+    LOCK(pwalletMain->cs_wallet);
+    for (size_t i = committed_; i < txs_.size(); i++) {
+        for (SendBatchInput& input : txs_[i].inputs) {
+            pwalletMain->UnlockCoin(input.outpoint);
+        }
+    }
+}
+
+/**
+ * Override getStatus() to append the operation's input parameters and
+ * progress to the default status object.
+ */
+UniValue AsyncRPCOperation_sendbatch::getStatus() const {
+    UniValue v = AsyncRPCOperation::getStatus();
+    UniValue obj = v.get_obj();
+    obj.push_back(Pair("method", "sendbatch"));
+    if (!contextinfo_.isNull()) {
+        obj.push_back(Pair("params", contextinfo_));
+    }
+    UniValue progress(UniValue::VOBJ);
+    progress.push_back(Pair("recipients", (uint64_t)recipients_.size()));
+    progress.push_back(Pair("planned", (uint64_t)planned_.load()));
+    progress.push_back(Pair("signed", (uint64_t)signed_.load()));
+    progress.push_back(Pair("committed", (uint64_t)committed_.load()));
+    obj.push_back(Pair("progress", progress));
+    return obj;
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2016 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ASYNCRPCOPERATION_SENDBATCH_H
+#define ASYNCRPCOPERATION_SENDBATCH_H
+
+#include "asyncrpcoperation.h"
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "wallet.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <univalue.h>
+
+// Default maximum number of recipients paid by one transaction
+#define SENDBATCH_DEFAULT_MAX_OUTPUTS   500
+
+// A coin selected to fund one of the batch transactions
+struct SendBatchInput
+{
+    COutPoint outpoint;
+    CScript scriptPubKey;
+    CAmount nValue;
+    CAmount nInterest;
+    int nChangeOf = -1;     // batch tx whose change this spends; its txid is filled in once that tx is signed
+};
+
+// One transaction of the batch, before and after signing
+struct SendBatchTx
+{
+    std::vector<CRecipient> recipients;
+    std::vector<SendBatchInput> inputs;
+    CAmount nFee = 0;
+    std::shared_ptr<CReserveKey> reservekey;   // for the change output, if any
+    CMutableTransaction mtx;
+};
+
+/**
+ * Pays a large list of transparent recipients. Coins are selected once for
+ * the whole list, recipients are packed into transactions of at most
+ * maxOutputs outputs, and once the confirmed coins run out, later
+ * transactions spend the change of earlier ones. The transactions are signed
+ * in parallel, parents before the transactions spending their change, and
+ * then added to the wallet in a single database transaction before being
+ * relayed.
+ */
+class AsyncRPCOperation_sendbatch : public AsyncRPCOperation {
+public:
+    AsyncRPCOperation_sendbatch(std::vector<CRecipient> recipients, int minDepth, int maxOutputs = SENDBATCH_DEFAULT_MAX_OUTPUTS, UniValue contextInfo = NullUniValue);
+    virtual ~AsyncRPCOperation_sendbatch();
+
+    // We don't want to be copied or moved around
+    AsyncRPCOperation_sendbatch(AsyncRPCOperation_sendbatch const&) = delete;             // Copy construct
+    AsyncRPCOperation_sendbatch(AsyncRPCOperation_sendbatch&&) = delete;                  // Move construct
+    AsyncRPCOperation_sendbatch& operator=(AsyncRPCOperation_sendbatch const&) = delete;  // Copy assign
+    AsyncRPCOperation_sendbatch& operator=(AsyncRPCOperation_sendbatch &&) = delete;      // Move assign
+
+    virtual void main();
+
+    virtual UniValue getStatus() const;
+
+private:
+    UniValue contextinfo_;     // optional data to include in return value from getStatus()
+
+    std::vector<CRecipient> recipients_;
+    int mindepth_;
+    int maxoutputs_;
+
+    std::vector<SendBatchTx> txs_;
+
+    // Progress, reported by getStatus()
+    std::atomic<size_t> planned_;
+    std::atomic<size_t> signed_;
+    std::atomic<size_t> committed_;
+
+    bool main_impl();
+    void plan_transactions();
+    void sign_transactions();
+    void sign_range(const std::vector<size_t>* indexes, size_t begin, size_t end, std::atomic<bool>* failed);
+    UniValue commit_transactions();
+    void unlock_inputs();
+};
+
+#endif /* ASYNCRPCOPERATION_SENDBATCH_H */
@@ -29,6 +29,11 @@
 #include <chrono>
 #include <thread>
 #include <string>
+#include <atomic>
+#include <exception>
+#include <mutex>
+
+#include <boost/thread.hpp>
 
 using namespace libzcash;
 
@@ -355,18 +360,17 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         zOutputsDeque.push_back(o);
     }
 
-    // When spending notes, take a snapshot of note witnesses and anchors as the treestate will
+    // Take a snapshot of note witnesses and the anchor they share as the treestate will
     // change upon arrival of new blocks which contain joinsplit transactions.  This is likely
     // to happen as creating a chained joinsplit transaction can take longer than the block interval.
-    if (z_inputs_.size() > 0) {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
+    // Everything below builds on the snapshot and does not lock the wallet or the chain.
+    {
+        std::vector<JSOutPoint> vOutPoints;
         for (auto t : z_inputs_) {
-            JSOutPoint jso = std::get<0>(t);
-            std::vector<JSOutPoint> vOutPoints = { jso };
-            uint256 inputAnchor;
-            std::vector<boost::optional<ZCIncrementalWitness>> vInputWitnesses;
-            pwalletMain->GetNoteWitnesses(vOutPoints, vInputWitnesses, inputAnchor);
-            jsopWitnessAnchorMap[ jso.ToString() ] = WitnessAnchorData{ vInputWitnesses[0], inputAnchor };
+            vOutPoints.push_back(std::get<0>(t));
+        }
+        if (!pwalletMain->GetNoteWitnessSnapshot(vOutPoints, witnessSnapshot_)) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Could not find witnesses sharing the same anchor for the selected notes");
         }
     }
 
@@ -406,7 +410,8 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
 
         // Create joinsplits, where each output represents a zaddr recipient.
-        UniValue obj(UniValue::VOBJ);
+        // They have no inputs, so they are independent and can be proved in parallel.
+        std::vector<AsyncJoinSplitInfo> infos;
         while (zOutputsDeque.size() > 0) {
             AsyncJoinSplitInfo info;
             info.vpub_old = 0;
@@ -429,8 +434,12 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 // Funds are removed from the value pool and enter the private pool
                 info.vpub_old += value;
             }
-            obj = perform_joinsplit(info);
+            infos.push_back(info);
         }
+
+        std::vector<std::vector<boost::optional < ZCIncrementalWitness>>> witnesses(infos.size());
+        std::vector<uint256> anchors(infos.size(), witnessSnapshot_.anchor);
+        UniValue obj = perform_joinsplits(infos, witnesses, anchors);
         sign_send_raw_transaction(obj);
         return true;
     }
@@ -464,6 +473,10 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         add_taddr_outputs_to_tx();
         CAmount taddrTargetAmount = t_outputs_total + minersFee;
         minersFeeProcessed = true;
+        // Each joinsplit spends its own notes, and only the last one can have
+        // change, so they are independent and can be proved in parallel.
+        std::vector<AsyncJoinSplitInfo> infos;
+        std::vector<std::vector<JSOutPoint>> vOutPoints;
         while (zInputsDeque.size() > 0 && taddrTargetAmount > 0) {
             AsyncJoinSplitInfo info;
             info.vpub_old = 0;
@@ -480,24 +493,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 info.notes.push_back(note);
                 outPoints.push_back(outPoint);
 
-                int wtxHeight = -1;
-                int wtxDepth = -1;
-                {
-                    LOCK2(cs_main, pwalletMain->cs_wallet);
-                    const CWalletTx& wtx = pwalletMain->mapWallet[outPoint.hash];
-                    wtxHeight = mapBlockIndex[wtx.hashBlock]->nHeight;
-                    wtxDepth = wtx.GetDepthInMainChain();
-                }
-                LogPrint("zrpcunsafe", "%s: spending note (txid=%s, vjoinsplit=%d, ciphertext=%d, amount=%s, height=%d, confirmations=%d)\n",
-                        getId(),
-                        outPoint.hash.ToString().substr(0, 10),
-                        outPoint.js,
-                        int(outPoint.n), // uint8_t
-                        FormatMoney(noteFunds),
-                        wtxHeight,
-                        wtxDepth
-                        );
-
+                log_note_spend(outPoint, noteFunds);
 
                 // Put value back into the value pool
                 if (noteFunds >= taddrTargetAmount) {
@@ -523,11 +519,19 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                         );
             }
 
-            obj = perform_joinsplit(info, outPoints);
+            infos.push_back(info);
+            vOutPoints.push_back(outPoints);
+        }
 
-            if (jsChange > 0) {
-                changeOutputIndex = find_output(obj, 1);
-            }
+        std::vector<std::vector<boost::optional < ZCIncrementalWitness>>> witnesses(infos.size());
+        std::vector<uint256> anchors(infos.size(), witnessSnapshot_.anchor);
+        for (size_t i = 0; i < infos.size(); i++) {
+            witnesses[i] = get_snapshot_witnesses(vOutPoints[i]);
+        }
+        obj = perform_joinsplits(infos, witnesses, anchors);
+
+        if (jsChange > 0) {
+            changeOutputIndex = find_output(obj, 1);
         }
     }
 
@@ -568,14 +572,14 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             // Consume change as the first input of the JoinSplit.
             //
             if (jsChange > 0) {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-
                 // Update tree state with previous joinsplit
                 ZCIncrementalMerkleTree tree;
                 auto it = intermediates.find(prevJoinSplit.anchor);
                 if (it != intermediates.end()) {
                     tree = it->second;
-                } else if (!pcoinsTip->GetAnchorAt(prevJoinSplit.anchor, tree)) {
+                } else if (prevJoinSplit.anchor == witnessSnapshot_.anchor) {
+                    tree = witnessSnapshot_.tree;
+                } else {
                     throw JSONRPCError(RPC_WALLET_ERROR, "Could not find previous JoinSplit anchor");
                 }
 
@@ -639,36 +643,20 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 CAmount noteFunds = std::get<2>(t);
                 zInputsDeque.pop_front();
 
-                WitnessAnchorData wad = jsopWitnessAnchorMap[ jso.ToString() ];
-                vInputWitnesses.push_back(wad.witness);
-                if (inputAnchor.IsNull()) {
-                    inputAnchor = wad.anchor;
-                } else if (inputAnchor != wad.anchor) {
-                    throw JSONRPCError(RPC_WALLET_ERROR, "Selected input notes do not share the same anchor");
+                auto wit = witnessSnapshot_.witnesses.find(jso);
+                if (wit != witnessSnapshot_.witnesses.end()) {
+                    vInputWitnesses.push_back(wit->second);
+                } else {
+                    vInputWitnesses.push_back(boost::none);
                 }
+                inputAnchor = witnessSnapshot_.anchor;
 
                 vOutPoints.push_back(jso);
                 vInputNotes.push_back(note);
 
                 jsInputValue += noteFunds;
 
-                int wtxHeight = -1;
-                int wtxDepth = -1;
-                {
-                    LOCK2(cs_main, pwalletMain->cs_wallet);
-                    const CWalletTx& wtx = pwalletMain->mapWallet[jso.hash];
-                    wtxHeight = mapBlockIndex[wtx.hashBlock]->nHeight;
-                    wtxDepth = wtx.GetDepthInMainChain();
-                }
-                LogPrint("zrpcunsafe", "%s: spending note (txid=%s, vjoinsplit=%d, ciphertext=%d, amount=%s, height=%d, confirmations=%d)\n",
-                        getId(),
-                        jso.hash.ToString().substr(0, 10),
-                        jso.js,
-                        int(jso.n), // uint8_t
-                        FormatMoney(noteFunds),
-                        wtxHeight,
-                        wtxDepth
-                        );
+                log_note_spend(jso, noteFunds);
             }
 
             // Add history of previous commitments to witness
@@ -942,6 +930,79 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         AsyncJoinSplitInfo & info,
         std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
         uint256 anchor)
+{
+    return add_joinsplit_to_tx(prove_joinsplit(info, witnesses, anchor, tx_.vjoinsplit.size()));
+}
+
+UniValue AsyncRPCOperation_sendmany::perform_joinsplits(
+        std::vector<AsyncJoinSplitInfo> & infos,
+        std::vector<std::vector<boost::optional < ZCIncrementalWitness>>> & witnesses,
+        std::vector<uint256> & anchors)
+{
+    assert(infos.size() == witnesses.size() && infos.size() == anchors.size());
+
+    size_t count = infos.size();
+    size_t firstIndex = tx_.vjoinsplit.size();
+    std::vector<AsyncJoinSplitProof> proofs(count);
+
+    int nThreads = GetArg("-zproofthreads", DEFAULT_ZPROOF_THREADS);
+    if (nThreads <= 0) {
+        nThreads = boost::thread::hardware_concurrency();
+    }
+    nThreads = std::max(1, std::min(nThreads, MAX_ZPROOF_THREADS));
+
+    if (nThreads == 1 || count <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            proofs[i] = prove_joinsplit(infos[i], witnesses[i], anchors[i], firstIndex + i);
+        }
+    } else {
+        // Each worker takes the next unproved JoinSplit; the first error is
+        // kept and rethrown once all the workers have stopped.
+        std::atomic<size_t> next(0);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+
+        auto worker = [&]() {
+            size_t i;
+            while ((i = next++) < count) {
+                try {
+                    proofs[i] = prove_joinsplit(infos[i], witnesses[i], anchors[i], firstIndex + i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    next = count;
+                }
+            }
+        };
+
+        LogPrint("zrpc", "%s: generating %d joinsplit proofs on %d threads\n",
+                getId(), count, std::min((size_t)nThreads, count));
+
+        boost::thread_group provers;
+        for (size_t t = 0; t < std::min((size_t)nThreads, count); t++) {
+            provers.create_thread(worker);
+        }
+        provers.join_all();
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    for (size_t i = 0; i < count; i++) {
+        obj = add_joinsplit_to_tx(proofs[i]);
+    }
+    return obj;
+}
+
+AsyncJoinSplitProof AsyncRPCOperation_sendmany::prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
+        uint256 anchor,
+        size_t index)
 {
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
@@ -971,11 +1032,9 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         throw runtime_error("unsupported joinsplit input/output counts");
     }
 
-    CMutableTransaction mtx(tx_);
-
     LogPrint("zrpcunsafe", "%s: creating joinsplit at index %d (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
             getId(),
-            tx_.vjoinsplit.size(),
+            index,
             FormatMoney(info.vpub_old), FormatMoney(info.vpub_new),
             FormatMoney(info.vjsin[0].note.value), FormatMoney(info.vjsin[1].note.value),
             FormatMoney(info.vjsout[0].value), FormatMoney(info.vjsout[1].value)
@@ -986,32 +1045,34 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
             {info.vjsin[0], info.vjsin[1]};
     boost::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs
             {info.vjsout[0], info.vjsout[1]};
-    #ifdef __LP64__
-    boost::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
-    boost::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
-    #else
-    boost::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
-    boost::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
-    #endif
-    JSDescription jsdesc = JSDescription::Randomized(
+    AsyncJoinSplitProof proof;
+    proof.jsdesc = JSDescription::Randomized(
             *pzcashParams,
             joinSplitPubKey_,
             anchor,
             inputs,
             outputs,
-            inputMap,
-            outputMap,
+            proof.inputMap,
+            proof.outputMap,
             info.vpub_old,
             info.vpub_new,
             !this->testmode);
 
     {
         auto verifier = libzcash::ProofVerifier::Strict();
-        if (!(jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
+        if (!(proof.jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
             throw std::runtime_error("error verifying joinsplit");
         }
     }
 
+    return proof;
+}
+
+UniValue AsyncRPCOperation_sendmany::add_joinsplit_to_tx(const AsyncJoinSplitProof & proof)
+{
+    const JSDescription & jsdesc = proof.jsdesc;
+
+    CMutableTransaction mtx(tx_);
     mtx.vjoinsplit.push_back(jsdesc);
 
     // Empty output script.
@@ -1067,10 +1128,10 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     UniValue arrInputMap(UniValue::VARR);
     UniValue arrOutputMap(UniValue::VARR);
     for (size_t i = 0; i < ZC_NUM_JS_INPUTS; i++) {
-        arrInputMap.push_back(inputMap[i]);
+        arrInputMap.push_back(proof.inputMap[i]);
     }
     for (size_t i = 0; i < ZC_NUM_JS_OUTPUTS; i++) {
-        arrOutputMap.push_back(outputMap[i]);
+        arrOutputMap.push_back(proof.outputMap[i]);
     }
 
     UniValue obj(UniValue::VOBJ);
@@ -1082,6 +1143,41 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     return obj;
 }
 
+std::vector<boost::optional < ZCIncrementalWitness>> AsyncRPCOperation_sendmany::get_snapshot_witnesses(
+        const std::vector<JSOutPoint> & outPoints) const
+{
+    std::vector<boost::optional < ZCIncrementalWitness>> witnesses;
+    for (const JSOutPoint & jso : outPoints) {
+        auto it = witnessSnapshot_.witnesses.find(jso);
+        if (it != witnessSnapshot_.witnesses.end()) {
+            witnesses.push_back(it->second);
+        } else {
+            witnesses.push_back(boost::none);
+        }
+    }
+    return witnesses;
+}
+
+void AsyncRPCOperation_sendmany::log_note_spend(const JSOutPoint & jso, CAmount noteFunds) const
+{
+    int wtxHeight = -1;
+    int wtxDepth = -1;
+    auto it = witnessSnapshot_.noteHeights.find(jso);
+    if (it != witnessSnapshot_.noteHeights.end() && it->second >= 0) {
+        wtxHeight = it->second;
+        wtxDepth = witnessSnapshot_.nHeight - wtxHeight + 1;
+    }
+    LogPrint("zrpcunsafe", "%s: spending note (txid=%s, vjoinsplit=%d, ciphertext=%d, amount=%s, height=%d, confirmations=%d)\n",
+            getId(),
+            jso.hash.ToString().substr(0, 10),
+            jso.js,
+            int(jso.n), // uint8_t
+            FormatMoney(noteFunds),
+            wtxHeight,
+            wtxDepth
+            );
+}
+
 void AsyncRPCOperation_sendmany::add_taddr_outputs_to_tx() {
 
     CMutableTransaction rawTx(tx_);
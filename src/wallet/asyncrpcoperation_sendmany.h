@@ -21,6 +21,10 @@
 // Default transaction fee if caller does not specify one.
 #define ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE   10000
 
+// Number of JoinSplit proofs generated in parallel by one operation (-zproofthreads)
+static const int DEFAULT_ZPROOF_THREADS = 1;
+static const int MAX_ZPROOF_THREADS = 16;
+
 using namespace libzcash;
 
 // A recipient is a tuple of address, amount, memo (optional if zaddr)
@@ -42,10 +46,17 @@ struct AsyncJoinSplitInfo
     CAmount vpub_new = 0;
 };
 
-// A struct to help us track the witness and anchor for a given JSOutPoint
-struct WitnessAnchorData {
-	boost::optional<ZCIncrementalWitness> witness;
-	uint256 anchor;
+// A proved JoinSplit, waiting to be added to the transaction
+struct AsyncJoinSplitProof
+{
+    JSDescription jsdesc;
+    #ifdef __LP64__
+    boost::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
+    boost::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    #else
+    boost::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
+    boost::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    #endif
 };
 
 class AsyncRPCOperation_sendmany : public AsyncRPCOperation {
@@ -82,8 +93,10 @@ private:
     uint256 joinSplitPubKey_;
     unsigned char joinSplitPrivKey_[crypto_sign_SECRETKEYBYTES];
 
-    // The key is the result string from calling JSOutPoint::ToString()
-    std::unordered_map<std::string, WitnessAnchorData> jsopWitnessAnchorMap;
+    // Witnesses of the selected notes and the tree state they share, taken
+    // once before any JoinSplit is built.  Proofs are generated from it
+    // without taking cs_main or cs_wallet.
+    CNoteWitnessSnapshot witnessSnapshot_;
 
     std::vector<SendManyRecipient> t_outputs_;
     std::vector<SendManyRecipient> z_outputs_;
@@ -111,6 +124,27 @@ private:
         std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
         uint256 anchor);
 
+    // Prove independent JoinSplits concurrently, then add them to the
+    // transaction in order.  Returns the result for the last JoinSplit.
+    UniValue perform_joinsplits(
+        std::vector<AsyncJoinSplitInfo> & infos,
+        std::vector<std::vector<boost::optional < ZCIncrementalWitness>>> & witnesses,
+        std::vector<uint256> & anchors);
+
+    // Generate the proof for the JoinSplit which will be at the given index
+    // in the transaction.  Does not touch tx_, so may run on any thread.
+    AsyncJoinSplitProof prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
+        uint256 anchor,
+        size_t index);
+
+    UniValue add_joinsplit_to_tx(const AsyncJoinSplitProof & proof);
+
+    // Witnesses for the given notes from the snapshot
+    std::vector<boost::optional < ZCIncrementalWitness>> get_snapshot_witnesses(const std::vector<JSOutPoint> & outPoints) const;
+    void log_note_spend(const JSOutPoint & jso, CAmount noteFunds) const;
+
     void sign_send_raw_transaction(UniValue obj);     // throws exception if there was an error
 
 };
@@ -225,7 +225,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL), nBatchSize(0), nBatchWrites(0)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -301,6 +301,8 @@ void CDB::Close()
 {
     if (!pdb)
         return;
+    if (nBatchSize)
+        BatchEnd();
     if (activeTxn)
         activeTxn->abort();
     activeTxn = NULL;
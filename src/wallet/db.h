@@ -96,6 +96,8 @@ protected:
     DbTxn* activeTxn;
     bool fReadOnly;
     bool fFlushOnClose;
+    unsigned int nBatchSize;    // writes per batch transaction, 0 when not batching
+    unsigned int nBatchWrites;  // writes made in the open batch transaction
 
     explicit CDB(const std::string& strFilename, const char* pszMode = "r+", bool fFlushOnCloseIn=true);
     ~CDB() { Close(); }
@@ -164,11 +166,15 @@ protected:
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
+        if (nBatchSize && !activeTxn && !TxnBegin())
+            return false;
         int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
 
         // Clear memory in case it was a private key
         memset(datKey.get_data(), 0, datKey.get_size());
         memset(datValue.get_data(), 0, datValue.get_size());
+        if (ret == 0 && nBatchSize && ++nBatchWrites >= nBatchSize)
+            return BatchCommit();
         return (ret == 0);
     }
 
@@ -187,10 +193,14 @@ protected:
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
+        if (nBatchSize && !activeTxn && !TxnBegin())
+            return false;
         int ret = pdb->del(activeTxn, &datKey, 0);
 
         // Clear memory
         memset(datKey.get_data(), 0, datKey.get_size());
+        if (ret == 0 && nBatchSize && ++nBatchWrites >= nBatchSize)
+            return BatchCommit();
         return (ret == 0 || ret == DB_NOTFOUND);
     }
 
@@ -218,8 +228,10 @@ protected:
     {
         if (!pdb)
             return NULL;
+        // A cursor of a batching handle reads inside its open transaction,
+        // so it sees the batch's writes and doesn't wait on their locks
         Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        int ret = pdb->cursor(activeTxn, &pcursor, 0);
         if (ret != 0)
             return NULL;
         return pcursor;
@@ -292,6 +304,40 @@ public:
         return (ret == 0);
     }
 
+    /**
+     * Batched writes. Between BatchBegin() and BatchEnd() the writes made
+     * through this handle are grouped into database transactions of at most
+     * nBatchSizeIn records instead of being committed one by one. A
+     * transaction is opened by the first write after a commit, so it is only
+     * open between a write and the next BatchCommit(), which callers use as
+     * durability points.
+     */
+    bool BatchBegin(unsigned int nBatchSizeIn)
+    {
+        if (!pdb || activeTxn || nBatchSize || nBatchSizeIn == 0)
+            return false;
+        nBatchSize = nBatchSizeIn;
+        nBatchWrites = 0;
+        return true;
+    }
+
+    bool BatchCommit()
+    {
+        nBatchWrites = 0;
+        if (!activeTxn)
+            return true;
+        return TxnCommit();
+    }
+
+    bool BatchEnd()
+    {
+        bool ret = BatchCommit();
+        nBatchSize = 0;
+        return ret;
+    }
+
+    bool IsBatching() const { return nBatchSize != 0; }
+
     bool ReadVersion(int& nVersion)
     {
         nVersion = 0;
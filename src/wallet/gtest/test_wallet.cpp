@@ -134,6 +134,33 @@ TEST(wallet_tests, note_data_serialisation) {
     EXPECT_EQ(noteData[jsoutpt].witnesses, noteData2[jsoutpt].witnesses);
 }
 
+TEST(wallet_tests, witness_cache_is_bounded) {
+    ZCIncrementalMerkleTree tree;
+    CNoteData nd;
+    for (size_t i = 0; i < WITNESS_CACHE_SIZE + 5; i++) {
+        tree.append(GetRandHash());
+        nd.witnesses.push_front(tree.witness());
+    }
+    EXPECT_EQ(WITNESS_CACHE_SIZE, nd.witnesses.size());
+    EXPECT_EQ(tree.root(), nd.witnesses.front().root());
+
+    // Same encoding as a list of witnesses
+    std::list<ZCIncrementalWitness> witnesses(nd.witnesses.begin(), nd.witnesses.end());
+    CDataStream ss1(SER_DISK, CLIENT_VERSION);
+    ss1 << nd.witnesses;
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << witnesses;
+    EXPECT_EQ(ss1.str(), ss2.str());
+
+    // Oversized caches keep their most recent witnesses
+    witnesses.push_back(witnesses.back());
+    ss2.clear();
+    ss2 << witnesses;
+    CNoteData nd2;
+    ss2 >> nd2.witnesses;
+    EXPECT_EQ(nd.witnesses, nd2.witnesses);
+}
+
 
 TEST(wallet_tests, find_unspent_notes) {
     SelectParams(CBaseChainParams::TESTNET);
@@ -181,6 +208,8 @@ TEST(wallet_tests, find_unspent_notes) {
 
 
     // We now have an unspent and confirmed note in the wallet (depth of 1)
+    EXPECT_EQ(10, wallet.GetPrivateBalance(1));
+    EXPECT_EQ(0, wallet.GetPrivateBalance(2));
     wallet.GetFilteredNotes(entries, "", 0);
     EXPECT_EQ(1, entries.size());
     entries.clear();
@@ -216,6 +245,7 @@ TEST(wallet_tests, find_unspent_notes) {
     EXPECT_TRUE(wallet.IsSpent(nullifier));
 
     // The note has been spent.  By default, GetFilteredNotes() ignores spent notes.
+    EXPECT_EQ(0, wallet.GetPrivateBalance(1));
     wallet.GetFilteredNotes(entries, "", 0);
     EXPECT_EQ(0, entries.size());
     entries.clear();
@@ -270,6 +300,7 @@ TEST(wallet_tests, find_unspent_notes) {
     wallet.AddToWallet(wtx3, true, NULL);
 
     // We now have an unspent note which has one confirmation, in addition to our spent note.
+    EXPECT_EQ(20, wallet.GetPrivateBalance(1));
     wallet.GetFilteredNotes(entries, "", 1);
     EXPECT_EQ(1, entries.size());
     entries.clear();
@@ -379,6 +410,61 @@ TEST(wallet_tests, FindMyNotes) {
     EXPECT_EQ(nd, noteMap[jsoutpt]);
 }
 
+TEST(wallet_tests, FindMyNotesWithDecryptors) {
+    CWallet wallet;
+
+    auto sk = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+
+    auto wtx = GetValidReceive(sk, 10, true);
+    auto note = GetNote(sk, wtx, 0, 1);
+    auto nullifier = note.nullifier(sk);
+
+    // Only the given decryptors are tried, as during a rescan
+    NoteDecryptorMap decryptors;
+    auto noteMap = wallet.FindMyNotes(wtx, decryptors);
+    EXPECT_EQ(0, noteMap.size());
+
+    decryptors.insert(std::make_pair(sk.address(), ZCNoteDecryption(sk.viewing_key())));
+    noteMap = wallet.FindMyNotes(wtx, decryptors);
+    EXPECT_EQ(wallet.FindMyNotes(wtx), noteMap);
+
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    CNoteData nd {sk.address(), nullifier};
+    EXPECT_EQ(1, noteMap.count(jsoutpt));
+    EXPECT_EQ(nd, noteMap[jsoutpt]);
+}
+
+TEST(wallet_tests, FindMyNotesInBlock) {
+    CWallet wallet;
+
+    auto sk = libzcash::SpendingKey::random();
+    auto sk2 = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+    // Enough trial decryptions for the block to be shared out over threads
+    for (int i = 0; i < 40; i++) {
+        wallet.AddSpendingKey(libzcash::SpendingKey::random());
+    }
+
+    CBlock block;
+    block.vtx.push_back(CTransaction());
+    for (int i = 0; i < 8; i++) {
+        block.vtx.push_back(GetValidReceive(i % 2 ? sk2 : sk, 10, true));
+    }
+
+    // Only transactions with JoinSplits are scanned
+    auto found = wallet.FindMyNotesInBlock(block, 4);
+    EXPECT_EQ(8, found.size());
+    EXPECT_EQ(0, found.count(block.vtx[0].GetHash()));
+    for (int i = 0; i < 8; i++) {
+        const CTransaction& tx = block.vtx[i + 1];
+        ASSERT_EQ(1, found.count(tx.GetHash()));
+        EXPECT_EQ(i % 2 ? 0 : 2, found[tx.GetHash()].size());
+        EXPECT_EQ(wallet.FindMyNotes(tx), found[tx.GetHash()]);
+    }
+    EXPECT_EQ(found, wallet.FindMyNotesInBlock(block, 1));
+}
+
 TEST(wallet_tests, FindMyNotesInEncryptedWallet) {
     TestWallet wallet;
     uint256 r {GetRandHash()};
@@ -865,7 +951,14 @@ TEST(wallet_tests, WriteWitnessCache) {
     auto sk = libzcash::SpendingKey::random();
     wallet.AddSpendingKey(sk);
 
+    // SetBestChain writes the transactions with live notes
     auto wtx = GetValidReceive(sk, 10, true);
+    auto note = GetNote(sk, wtx, 0, 1);
+    mapNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    CNoteData nd {sk.address(), note.nullifier(sk)};
+    noteData[jsoutpt] = nd;
+    wtx.SetNoteData(noteData);
     wallet.AddToWallet(wtx, true, NULL);
 
     // TxnBegin fails
@@ -934,6 +1027,45 @@ TEST(wallet_tests, WriteWitnessCache) {
     wallet.SetBestChain(walletdb, loc);
 }
 
+TEST(wallet_tests, SetBestChainWritesOnlyLiveNotes) {
+    TestWallet wallet;
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+
+    auto sk = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+
+    // A transaction with one of our notes
+    auto wtx = GetValidReceive(sk, 10, true);
+    auto note = GetNote(sk, wtx, 0, 1);
+    mapNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    CNoteData nd {sk.address(), note.nullifier(sk)};
+    noteData[jsoutpt] = nd;
+    wtx.SetNoteData(noteData);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    // and one without notes
+    auto wtx2 = GetValidReceive(sk, 20, true);
+    wallet.AddToWallet(wtx2, true, NULL);
+
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillRepeatedly(Return(true));
+
+    // Only the transaction with a live note is rewritten
+    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(wtx2.GetHash(), wtx2))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
+}
+
 TEST(wallet_tests, UpdateNullifierNoteMap) {
     TestWallet wallet;
     uint256 r {GetRandHash()};
@@ -1046,3 +1178,145 @@ TEST(wallet_tests, MarkAffectedTransactionsDirty) {
     wallet.MarkAffectedTransactionsDirty(wtx2);
     EXPECT_FALSE(wallet.mapWallet[hash].fDebitCached);
 }
+
+TEST(wallet_tests, cached_balances_follow_wallet_updates) {
+    TestWallet wallet;
+
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKey(key);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = scriptPubKey;
+    mtx.vout[0].nValue = 10;
+    CWalletTx wtx {&wallet, mtx};
+    mtx.vout[0].nValue = 5;
+    CWalletTx wtx2 {&wallet, mtx};
+
+    // Fake-mine both transactions
+    EXPECT_EQ(-1, chainActive.Height());
+    CBlock block;
+    block.vtx.push_back(wtx);
+    block.vtx.push_back(wtx2);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+    wtx.SetMerkleBranch(block);
+    wtx2.SetMerkleBranch(block);
+    EXPECT_EQ(0, wallet.GetBalance());
+
+    // Adding a transaction invalidates the cached totals
+    wallet.AddToWallet(wtx, true, NULL);
+    EXPECT_EQ(10, wallet.GetBalance());
+
+    wallet.AddToWallet(wtx2, true, NULL);
+    EXPECT_EQ(15, wallet.GetBalance());
+    EXPECT_EQ(0, wallet.GetUnconfirmedBalance());
+    EXPECT_EQ(0, wallet.GetImmatureBalance());
+
+    // As does marking the wallet dirty
+    wallet.MarkDirty();
+    EXPECT_EQ(15, wallet.GetBalance());
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+}
+
+TEST(wallet_tests, unspent_txs_follow_new_scripts) {
+    TestWallet wallet;
+
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKey(key);
+    CScript redeemScript = GetScriptForMultisig(1, std::vector<CPubKey>(1, key.GetPubKey()));
+    CKey watchKey;
+    watchKey.MakeNewKey(true);
+    CScript watchScript = GetScriptForDestination(watchKey.GetPubKey().GetID());
+
+    CMutableTransaction mtx;
+    mtx.vout.resize(2);
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    mtx.vout[0].nValue = 10;
+    mtx.vout[1].scriptPubKey = watchScript;
+    mtx.vout[1].nValue = 5;
+    CWalletTx wtx {&wallet, mtx};
+
+    // Fake-mine the transaction
+    EXPECT_EQ(-1, chainActive.Height());
+    CBlock block;
+    block.vtx.push_back(wtx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+    wtx.SetMerkleBranch(block);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    // None of its outputs are ours, so computing the balances evicts it,
+    // and adding the script behind the wallet's back doesn't bring it back
+    std::vector<COutput> vCoins;
+    EXPECT_EQ(0, wallet.GetBalance());
+    wallet.CCryptoKeyStore::AddCScript(redeemScript);
+    wallet.AvailableCoins(vCoins);
+    EXPECT_EQ(0, vCoins.size());
+
+    // Adding the script through the wallet does
+    EXPECT_TRUE(wallet.AddCScript(redeemScript));
+    wallet.AvailableCoins(vCoins);
+    EXPECT_EQ(1, vCoins.size());
+    EXPECT_EQ(10, wallet.GetBalance());
+
+    // and so does a watch-only address
+    EXPECT_TRUE(wallet.AddWatchOnly(watchScript));
+    wallet.AvailableCoins(vCoins);
+    EXPECT_EQ(2, vCoins.size());
+    EXPECT_EQ(5, wallet.GetWatchOnlyBalance());
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+}
+
+TEST(wallet_tests, rescan_block_in_batch) {
+    bool fFirstRun;
+    CWallet wallet("wallet_rescan_batch.dat");
+    ASSERT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKey(key);
+
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    mtx.vout[0].nValue = 10;
+    CBlock block;
+    block.vtx.push_back(mtx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+
+    // Adding a mined transaction writes its order position in the batch's
+    // transaction and then lists the accounting entries, which must not
+    // wait on the locks of that transaction
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        CWalletDBBatch batch(&wallet, false);
+        EXPECT_TRUE(wallet.AddToWalletIfInvolvingMe(block.vtx[0], &block, true));
+        std::list<CAccountingEntry> acentries;
+        EXPECT_EQ(1, wallet.OrderedTxItems(acentries).size());
+    }
+    mapBlockIndex.erase(blockHash);
+
+    // and the transaction was committed with the batch
+    CWallet wallet2("wallet_rescan_batch.dat");
+    ASSERT_EQ(DB_LOAD_OK, wallet2.LoadWallet(fFirstRun));
+    EXPECT_EQ(1, wallet2.mapWallet.count(block.vtx[0].GetHash()));
+}
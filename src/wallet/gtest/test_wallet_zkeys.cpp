@@ -139,6 +139,44 @@ TEST(wallet_zkeys_tests, write_zkey_direct_to_db) {
 }
 
 
+/**
+ * This test covers CWalletDBBatch
+ */
+TEST(wallet_zkeys_tests, write_zkeys_in_batch) {
+    SelectParams(CBaseChainParams::TESTNET);
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    bool fFirstRun;
+    CWallet wallet("wallet.dat");
+    ASSERT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+
+    // Add more keys than fit in one batch transaction
+    {
+        LOCK(wallet.cs_wallet);
+        CWalletDBBatch batch(&wallet);
+        for (unsigned int i = 0; i < WALLET_DB_BATCH_SIZE + 1; i++) {
+            wallet.GenerateNewZKey();
+        }
+
+        // A nested batch writes through the enclosing one
+        CWalletDBBatch nested(&wallet);
+        auto sk = libzcash::SpendingKey::random();
+        CKeyMetadata meta(GetTime());
+        ASSERT_TRUE(nested.Get().WriteZKey(sk.address(), sk, meta));
+    }
+
+    // All the keys were committed
+    CWallet wallet2("wallet.dat");
+    ASSERT_EQ(DB_LOAD_OK, wallet2.LoadWallet(fFirstRun));
+    std::set<libzcash::PaymentAddress> addrs;
+    wallet2.GetPaymentAddresses(addrs);
+    ASSERT_EQ(WALLET_DB_BATCH_SIZE + 2, addrs.size());
+}
+
+
 
 /**
  * This test covers methods on CWalletDB to load/save crypted z keys.
@@ -24,11 +24,15 @@
 #include "asyncrpcoperation.h"
 #include "asyncrpcqueue.h"
 #include "wallet/asyncrpcoperation_sendmany.h"
+#include "wallet/asyncrpcoperation_sendbatch.h"
 
 #include "sodium.h"
 
 #include <stdint.h>
 
+#include <fstream>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
 
 #include <univalue.h>
@@ -2870,6 +2874,9 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
         } else if (benchmarktype == "trydecryptnotes") {
             int nAddrs = params[2].get_int();
             sample_times.push_back(benchmark_try_decrypt_notes(nAddrs));
+        } else if (benchmarktype == "trydecryptnotesunbatched") {
+            int nAddrs = params[2].get_int();
+            sample_times.push_back(benchmark_try_decrypt_notes_unbatched(nAddrs));
         } else if (benchmarktype == "incnotewitnesses") {
             int nTxs = params[2].get_int();
             sample_times.push_back(benchmark_increment_note_witnesses(nTxs));
@@ -3467,7 +3474,7 @@ UniValue z_gettotalbalance(const UniValue& params, bool fHelp)
     // pwalletMain->GetBalance() does not accept min depth parameter
     // so we use our own method to get balance of utxos.
     CAmount nBalance = getBalanceTaddr("", nMinDepth);
-    CAmount nPrivateBalance = getBalanceZaddr("", nMinDepth);
+    CAmount nPrivateBalance = pwalletMain->GetPrivateBalance(nMinDepth);
     uint64_t interest = safecoin_interestsum();
     CAmount nTotalBalance = nBalance + nPrivateBalance + interest;
     UniValue result(UniValue::VOBJ);
@@ -3582,10 +3589,6 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
 // We reduce the result by 1 to ensure there is room for non-joinsplit CTransaction data.
 #define Z_SENDMANY_MAX_ZADDR_OUTPUTS    ((MAX_TX_SIZE / JSDescription().GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION)) - 1)
 
-// transaction.h comment: spending taddr output requires CTxIn >= 148 bytes and typical taddr txout is 34 bytes
-#define CTXIN_SPEND_DUST_SIZE   148
-#define CTXOUT_REGULAR_SIZE     34
-
 UniValue z_sendmany(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -3773,6 +3776,116 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
 }
 
 
+UniValue sendbatch(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "sendbatch \"filename\"|[{\"address\":... ,\"amount\":...},...] ( minconf ) ( maxoutputs )\n"
+            "\nPay a large number of transparent recipients. Coins are selected once for the whole list,"
+            "\nrecipients are packed into transactions of at most maxoutputs outputs, which are signed in parallel"
+            "\nand added to the wallet together. Change goes to new addresses and fees are paid on top of the amounts."
+            "\nCoinbase outputs are never selected, as they can only be sent to a zaddr with z_sendmany."
+            + HelpRequiringPassphrase() + "\n"
+            "\nArguments:\n"
+            "1. \"filename\"            (string) A file with one \"address amount\" pair per line. Empty lines and lines starting with # are skipped.\n"
+            "   or \"amounts\"          (array) An array of json objects representing the amounts to send.\n"
+            "    [{\n"
+            "      \"address\":address  (string, required) The taddr to send to\n"
+            "      \"amount\":amount    (numeric, required) The amount to send\n"
+            "    }, ... ]\n"
+            "2. minconf               (numeric, optional, default=1) Only use funds confirmed at least this many times.\n"
+            "3. maxoutputs            (numeric, optional, default=" + strprintf("%d", SENDBATCH_DEFAULT_MAX_OUTPUTS) + ") Maximum number of recipients per transaction.\n"
+            "\nResult:\n"
+            "\"operationid\"          (string) An operationid to pass to z_getoperationstatus to follow the progress and z_getoperationresult to get the txids.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendbatch", "\"/tmp/payouts.txt\" 1 500")
+            + HelpExampleRpc("sendbatch", "[{\"address\":\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\", \"amount\":0.01}]")
+        );
+
+    // Recipients as given by the caller, in order
+    std::vector<std::pair<std::string, CAmount>> vPayouts;
+    if (params[0].isStr()) {
+        ifstream file(params[0].get_str().c_str());
+        if (!file.is_open())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open payout file");
+        std::string line;
+        int nLine = 0;
+        while (std::getline(file, line)) {
+            nLine++;
+            boost::trim(line);
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::vector<std::string> vstr;
+            boost::split(vstr, line, boost::is_any_of(" \t"), boost::token_compress_on);
+            CAmount nAmount;
+            if (vstr.size() != 2 || !ParseFixedPoint(vstr[1], 8, &nAmount))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid payout on line %d, expected \"address amount\"", nLine));
+            vPayouts.push_back(std::make_pair(vstr[0], nAmount));
+        }
+    } else {
+        for (const UniValue& o : params[0].get_array().getValues()) {
+            if (!o.isObject())
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, expected object");
+            vPayouts.push_back(std::make_pair(find_value(o, "address").get_str(), AmountFromValue(find_value(o, "amount"))));
+        }
+    }
+
+    std::vector<CRecipient> vecSend;
+    CAmount nTotalOut = 0;
+    for (const std::pair<std::string, CAmount>& payout : vPayouts) {
+        CBitcoinAddress address(payout.first);
+        if (!address.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("Invalid Safecoin address: ") + payout.first);
+        CTxOut txout(payout.second, GetScriptForDestination(address.Get()));
+        if (payout.second <= 0 || txout.IsDust(::minRelayTxFee))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid amount for send to ") + payout.first);
+        CRecipient recipient = {txout.scriptPubKey, payout.second, false};
+        vecSend.push_back(recipient);
+        nTotalOut += payout.second;
+        if (!MoneyRange(nTotalOut))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, total amount out of range");
+    }
+    if (vecSend.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, no recipients");
+
+    int nMinDepth = 1;
+    if (params.size() > 1)
+        nMinDepth = params[1].get_int();
+    if (nMinDepth < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Minimum number of confirmations cannot be less than 0");
+
+    int nMaxOutputs = SENDBATCH_DEFAULT_MAX_OUTPUTS;
+    if (params.size() > 2)
+        nMaxOutputs = params[2].get_int();
+    if (nMaxOutputs < 1 || CTXOUT_REGULAR_SIZE * (nMaxOutputs + 1) + CTXIN_SPEND_DUST_SIZE >= MAX_TX_SIZE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, maxoutputs must be between 1 and %d", (MAX_TX_SIZE - CTXIN_SPEND_DUST_SIZE) / CTXOUT_REGULAR_SIZE - 2));
+
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        EnsureWalletIsUnlocked();
+    }
+
+    // The recipients can run into the hundreds of thousands, so only their
+    // count is returned by z_getoperationstatus.
+    UniValue o(UniValue::VOBJ);
+    o.push_back(Pair("recipients", (uint64_t)vecSend.size()));
+    o.push_back(Pair("amount", ValueFromAmount(nTotalOut)));
+    o.push_back(Pair("minconf", nMinDepth));
+    o.push_back(Pair("maxoutputs", nMaxOutputs));
+    UniValue contextInfo = o;
+
+    // Create operation and add to global queue
+    std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
+    std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_sendbatch(vecSend, nMinDepth, nMaxOutputs, contextInfo) );
+    q->addOperation(operation);
+    AsyncRPCOperationId operationId = operation->getId();
+    return operationId;
+}
+
+
 UniValue z_listoperationids(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -303,7 +303,32 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
             }
             BOOST_CHECK_NE(fails, RANDOM_REPEATS);
         }
+
+        // with thousands of small coins, an exact subset is still found
+        empty_wallet();
+        for (int i2 = 0; i2 < 1500; i2++)
+            add_coin(CENT);
+        add_coin(3 * COIN);
+        BOOST_CHECK( wallet.SelectCoinsMinConf(5 * COIN, 1, 1, vCoins, setCoinsRet, nValueRet,0));
+        BOOST_CHECK_EQUAL(nValueRet, 5 * COIN);
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 201U); // 3 + 200 * 0.01
+
+        // and without one, the largest coins are used
+        add_coin(0.5 * CENT);
+        BOOST_CHECK( wallet.SelectCoinsMinConf(5.005 * COIN + 0.25 * CENT, 1, 1, vCoins, setCoinsRet, nValueRet,0));
+        BOOST_CHECK_GE(nValueRet, 5.005 * COIN + 0.25 * CENT);
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 203U);
     }
+
+    // the exact search stays bounded with many coins of a few values and no
+    // exact match, where each step used to rescan the coins
+    empty_wallet();
+    for (int i = 0; i < 100000; i++)
+        add_coin((1 + i % 5) * CENT);
+    int64_t nStart = GetTimeMillis();
+    BOOST_CHECK( wallet.SelectCoinsMinConf(20000 * CENT + 1, 1, 1, vCoins, setCoinsRet, nValueRet,0));
+    BOOST_CHECK_GE(nValueRet, 20000 * CENT + 1);
+    BOOST_CHECK_LT(GetTimeMillis() - nStart, 1000);
     empty_wallet();
 }
 
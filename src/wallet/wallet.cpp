@@ -20,8 +20,12 @@
 #include "crypter.h"
 #include "coins.h"
 #include <assert.h>
+#include <atomic>
+#include <deque>
+#include <memory>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -115,6 +119,8 @@ bool CWallet::AddZKey(const libzcash::SpendingKey &key)
         return true;
 
     if (!IsCrypted()) {
+        if (pwalletdbBatch)
+            return pwalletdbBatch->WriteZKey(addr, key, mapZKeyMetadata[addr]);
         return CWalletDB(strWalletFile).WriteZKey(addr,
                                                   key,
                                                   mapZKeyMetadata[addr]);
@@ -132,7 +138,7 @@ CPubKey CWallet::GenerateNewKey()
 
     // Compressed public keys were introduced in version 0.6.0
     if (fCompressed)
-        SetMinVersion(FEATURE_COMPRPUBKEY);
+        SetMinVersion(FEATURE_COMPRPUBKEY, pwalletdbBatch);
 
     CPubKey pubkey = secret.GetPubKey();
     assert(secret.VerifyPubKey(pubkey));
@@ -163,6 +169,8 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
+        if (pwalletdbBatch)
+            return pwalletdbBatch->WriteKey(pubkey, secret.GetPrivKey(), mapKeyMetadata[pubkey.GetID()]);
         return CWalletDB(strWalletFile).WriteKey(pubkey,
                                                  secret.GetPrivKey(),
                                                  mapKeyMetadata[pubkey.GetID()]);
@@ -184,6 +192,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
             return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
                                                         vchCryptedSecret,
                                                         mapKeyMetadata[vchPubKey.GetID()]);
+        else if (pwalletdbBatch)
+            return pwalletdbBatch->WriteCryptedKey(vchPubKey,
+                                                   vchCryptedSecret,
+                                                   mapKeyMetadata[vchPubKey.GetID()]);
         else
             return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
                                                             vchCryptedSecret,
@@ -208,6 +220,11 @@ bool CWallet::AddCryptedSpendingKey(const libzcash::PaymentAddress &address,
                                                          vk,
                                                          vchCryptedSecret,
                                                          mapZKeyMetadata[address]);
+        } else if (pwalletdbBatch) {
+            return pwalletdbBatch->WriteCryptedZKey(address,
+                                                    vk,
+                                                    vchCryptedSecret,
+                                                    mapZKeyMetadata[address]);
         } else {
             return CWalletDB(strWalletFile).WriteCryptedZKey(address,
                                                              vk,
@@ -254,6 +271,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    // Outputs already in the wallet may have become ours
+    MarkDirty();
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -279,6 +298,8 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    // Outputs already in the wallet may have become ours
+    MarkDirty();
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -293,9 +314,13 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
         return false;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
-    if (fFileBacked)
-        if (!CWalletDB(strWalletFile).EraseWatchOnly(dest))
+    if (fFileBacked) {
+        if (pwalletdbBatch) {
+            if (!pwalletdbBatch->EraseWatchOnly(dest))
+                return false;
+        } else if (!CWalletDB(strWalletFile).EraseWatchOnly(dest))
             return false;
+    }
 
     return true;
 }
@@ -374,6 +399,21 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 void CWallet::ChainTip(const CBlockIndex *pindex, const CBlock *pblock,
                        ZCIncrementalMerkleTree tree, bool added)
 {
+    LOCK(cs_wallet);
+    // All transactions of the block are synced; keys added before it is
+    // connected again must be tried as well
+    hashSyncBlock.SetNull();
+    mapSyncNoteData.clear();
+    if (fRescanning && pindex->nHeight > nRescanHeight) {
+        // The rescan will add this block itself when it gets there
+        if (!added)
+            DecrementNoteWitnessesAboveRescan(pindex);
+        return;
+    }
+    if (fRescanning && !added) {
+        // Make the rescan pick up again from the fork
+        nRescanHeight = pindex->nHeight - 1;
+    }
     if (added) {
         IncrementNoteWitnesses(pindex, pblock, tree);
     } else if ( ASSETCHAINS_SYMBOL[0] == 0 || nWitnessCacheSize > 1 ){
@@ -383,6 +423,13 @@ void CWallet::ChainTip(const CBlockIndex *pindex, const CBlock *pblock,
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    {
+        LOCK(cs_wallet);
+        // Until a rescan has caught up with the tip, the witness caches
+        // are behind loc. The rescan's caller records the best chain.
+        if (fRescanning)
+            return;
+    }
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
 }
@@ -636,6 +683,7 @@ void CWallet::ClearNoteWitnessCache()
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
         }
+        AddToLiveNotes(wtxItem.second);
     }
     nWitnessCacheSize = 0;
     //fprintf(stderr,"Clear witness cache\n");
@@ -648,29 +696,32 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
     //fprintf(stderr,"A increment witness cache -> %d\n",(int32_t)nWitnessCacheSize);
     {
         LOCK(cs_wallet);
-        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-            for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                CNoteData* nd = &(item.second);
-                // Only increment witnesses that are behind the current height
-                if (nd->witnessHeight < pindex->nHeight) {
-                    // Check the validity of the cache
-                    // The only time a note witnessed above the current height
-                    // would be invalid here is during a reindex when blocks
-                    // have been decremented, and we are incrementing the blocks
-                    // immediately after.
-                    assert(nWitnessCacheSize >= nd->witnesses.size());
-                    // Witnesses being incremented should always be either -1
-                    // (never incremented or decremented) or one below pindex
-                    assert((nd->witnessHeight == -1) ||
-                           (nd->witnessHeight == pindex->nHeight - 1));
-                    // Copy the witness for the previous block if we have one
-                    if (nd->witnesses.size() > 0) {
-                        nd->witnesses.push_front(nd->witnesses.front());
-                    }
-                    if (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
-                        nd->witnesses.pop_back();
-                    }
+        // Notes behind the current height, and those of them that already
+        // have a witness to carry forward
+        std::vector<CNoteData*> vBehind;
+        std::vector<CNoteData*> vIncrement;
+        for (const JSOutPoint& jsoutpt : setLiveNotes) {
+            CNoteData* nd = &(mapWallet[jsoutpt.hash].mapNoteData[jsoutpt]);
+            // Only increment witnesses that are behind the current height
+            if (nd->witnessHeight < pindex->nHeight) {
+                // Check the validity of the cache
+                // The only time a note witnessed above the current height
+                // would be invalid here is during a reindex when blocks
+                // have been decremented, and we are incrementing the blocks
+                // immediately after.
+                assert(nWitnessCacheSize >= nd->witnesses.size());
+                // Witnesses being incremented should always be either -1
+                // (never incremented or decremented) or one below pindex
+                assert((nd->witnessHeight == -1) ||
+                       (nd->witnessHeight == pindex->nHeight - 1));
+                // Copy the witness for the previous block if we have one.
+                // The cache drops its oldest witness once full.
+                if (nd->witnesses.size() > 0) {
+                    ZCIncrementalWitness witness = nd->witnesses.front();
+                    nd->witnesses.push_front(witness);
+                    vIncrement.push_back(nd);
                 }
+                vBehind.push_back(nd);
             }
         }
         if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
@@ -685,6 +736,11 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
             pblock = &block;
         }
 
+        // Append the block's commitments to the tree, witnessing our new
+        // notes as they are reached. Existing witnesses are brought up to
+        // date afterwards, in one pass per note.
+        std::vector<uint256> vCommitments;
+        std::vector<std::pair<CNoteData*, size_t>> vNew;
         for (const CTransaction& tx : pblock->vtx) {
             auto hash = tx.GetHash();
             bool txIsOurs = mapWallet.count(hash);
@@ -693,20 +749,7 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                 for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
                     const uint256& note_commitment = jsdesc.commitments[j];
                     tree.append(note_commitment);
-
-                    // Increment existing witnesses
-                    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                        for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                            CNoteData* nd = &(item.second);
-                            if (nd->witnessHeight < pindex->nHeight &&
-                                    nd->witnesses.size() > 0) {
-                                // Check the validity of the cache
-                                // See earlier comment about validity.
-                                assert(nWitnessCacheSize >= nd->witnesses.size());
-                                nd->witnesses.front().append(note_commitment);
-                            }
-                        }
-                    }
+                    vCommitments.push_back(note_commitment);
 
                     // If this is our note, witness it
                     if (txIsOurs) {
@@ -730,62 +773,129 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                           pindex->nHeight,
                                           tree.witness().root().GetHex());
                                 nd->witnesses.clear();
+                                vIncrement.erase(std::remove(vIncrement.begin(), vIncrement.end(), nd),
+                                                 vIncrement.end());
                             }
                             nd->witnesses.push_front(tree.witness());
+                            vNew.push_back(std::make_pair(nd, vCommitments.size()));
                             // Set height to one less than pindex so it gets incremented
                             nd->witnessHeight = pindex->nHeight - 1;
                             // Check the validity of the cache
                             assert(nWitnessCacheSize >= nd->witnesses.size());
+                            // Make sure the note is maintained from now on
+                            if (setLiveNotes.insert(jsoutpt).second) {
+                                vBehind.push_back(nd);
+                            }
                         }
                     }
                 }
             }
         }
 
+        // Increment existing witnesses
+        for (CNoteData* nd : vIncrement) {
+            // Check the validity of the cache
+            // See earlier comment about validity.
+            assert(nWitnessCacheSize >= nd->witnesses.size());
+            ZCIncrementalWitness& witness = nd->witnesses.front();
+            for (const uint256& note_commitment : vCommitments) {
+                witness.append(note_commitment);
+            }
+        }
+        // New witnesses only need the commitments that followed their note
+        for (const std::pair<CNoteData*, size_t>& item : vNew) {
+            ZCIncrementalWitness& witness = item.first->witnesses.front();
+            for (size_t k = item.second; k < vCommitments.size(); k++) {
+                witness.append(vCommitments[k]);
+            }
+        }
+
         // Update witness heights
-        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-            for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                CNoteData* nd = &(item.second);
-                if (nd->witnessHeight < pindex->nHeight) {
-                    nd->witnessHeight = pindex->nHeight;
-                    // Check the validity of the cache
-                    // See earlier comment about validity.
-                    assert(nWitnessCacheSize >= nd->witnesses.size());
-                }
+        for (CNoteData* nd : vBehind) {
+            if (nd->witnessHeight < pindex->nHeight) {
+                nd->witnessHeight = pindex->nHeight;
+                // Check the validity of the cache
+                // See earlier comment about validity.
+                assert(nWitnessCacheSize >= nd->witnesses.size());
             }
         }
 
+        PruneSpentNoteWitnesses(pindex);
+
         // For performance reasons, we write out the witness cache in
         // CWallet::SetBestChain() (which also ensures that overall consistency
         // of the wallet.dat is maintained).
     }
 }
 
+/**
+ * Stops maintaining the witnesses of notes whose spend is buried deeper
+ * than the witness cache, since they can not become spendable again.
+ */
+void CWallet::PruneSpentNoteWitnesses(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_wallet);
+    for (std::set<JSOutPoint>::iterator it = setLiveNotes.begin(); it != setLiveNotes.end(); ) {
+        CNoteData* nd = &(mapWallet[it->hash].mapNoteData[*it]);
+        bool fPruned = false;
+        if (nd->nullifier) {
+            pair<TxNullifiers::const_iterator, TxNullifiers::const_iterator> range;
+            range = mapTxNullifiers.equal_range(*nd->nullifier);
+            for (TxNullifiers::const_iterator sit = range.first; sit != range.second && !fPruned; ++sit) {
+                std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(sit->second);
+                if (mit == mapWallet.end() || mit->second.hashBlock.IsNull())
+                    continue;
+                BlockMap::const_iterator bit = mapBlockIndex.find(mit->second.hashBlock);
+                if (bit == mapBlockIndex.end() || !chainActive.Contains(bit->second))
+                    continue;
+                fPruned = pindex->nHeight - bit->second->nHeight >= (int)WITNESS_CACHE_SIZE;
+            }
+        }
+        if (fPruned) {
+            nd->witnesses.clear();
+            nd->witnessHeight = -1;
+            setPrunedNoteTxs.insert(it->hash);
+            setLiveNotes.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * Starts maintaining the witnesses of the notes in wtx.
+ */
+void CWallet::AddToLiveNotes(const CWalletTx& wtx)
+{
+    LOCK(cs_wallet);
+    for (const mapNoteData_t::value_type& item : wtx.mapNoteData) {
+        setLiveNotes.insert(item.first);
+    }
+}
+
 void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
 {
     extern int32_t SAFECOIN_REWIND;
     {
         LOCK(cs_wallet);
-        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-            for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                CNoteData* nd = &(item.second);
-                // Only increment witnesses that are not above the current height
-                if (nd->witnessHeight <= pindex->nHeight) {
-                    // Check the validity of the cache
-                    // See comment below (this would be invalid if there was a
-                    // prior decrement).
-                    assert(nWitnessCacheSize >= nd->witnesses.size());
-                    // Witnesses being decremented should always be either -1
-                    // (never incremented or decremented) or equal to pindex
-                    assert((nd->witnessHeight == -1) ||
-                           (nd->witnessHeight == pindex->nHeight));
-                    if (nd->witnesses.size() > 0) {
-                        nd->witnesses.pop_front();
-                    }
-                    // pindex is the block being removed, so the new witness cache
-                    // height is one below it.
-                    nd->witnessHeight = pindex->nHeight - 1;
+        for (const JSOutPoint& jsoutpt : setLiveNotes) {
+            CNoteData* nd = &(mapWallet[jsoutpt.hash].mapNoteData[jsoutpt]);
+            // Only increment witnesses that are not above the current height
+            if (nd->witnessHeight <= pindex->nHeight) {
+                // Check the validity of the cache
+                // See comment below (this would be invalid if there was a
+                // prior decrement).
+                assert(nWitnessCacheSize >= nd->witnesses.size());
+                // Witnesses being decremented should always be either -1
+                // (never incremented or decremented) or equal to pindex
+                assert((nd->witnessHeight == -1) ||
+                       (nd->witnessHeight == pindex->nHeight));
+                if (nd->witnesses.size() > 0) {
+                    nd->witnesses.pop_front();
                 }
+                // pindex is the block being removed, so the new witness cache
+                // height is one below it.
+                nd->witnessHeight = pindex->nHeight - 1;
             }
         }
         //fprintf(stderr,"decrement witness cache -> %d\n",(int32_t)nWitnessCacheSize);
@@ -795,22 +905,20 @@ void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
         {
             fprintf(stderr,"%s nWitnessCacheSize.%d\n",ASSETCHAINS_SYMBOL,(int32_t)nWitnessCacheSize);
         }
-        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-            for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                CNoteData* nd = &(item.second);
-                // Check the validity of the cache
-                // Technically if there are notes witnessed above the current
-                // height, their cache will now be invalid (relative to the new
-                // value of nWitnessCacheSize). However, this would only occur
-                // during a reindex, and by the time the reindex reaches the tip
-                // of the chain again, the existing witness caches will be valid
-                // again.
-                // We don't set nWitnessCacheSize to zero at the start of the
-                // reindex because the on-disk blocks had already resulted in a
-                // chain that didn't trigger the assertion below.
-                if (nd->witnessHeight < pindex->nHeight) {
-                    assert(nWitnessCacheSize >= nd->witnesses.size());
-                }
+        for (const JSOutPoint& jsoutpt : setLiveNotes) {
+            CNoteData* nd = &(mapWallet[jsoutpt.hash].mapNoteData[jsoutpt]);
+            // Check the validity of the cache
+            // Technically if there are notes witnessed above the current
+            // height, their cache will now be invalid (relative to the new
+            // value of nWitnessCacheSize). However, this would only occur
+            // during a reindex, and by the time the reindex reaches the tip
+            // of the chain again, the existing witness caches will be valid
+            // again.
+            // We don't set nWitnessCacheSize to zero at the start of the
+            // reindex because the on-disk blocks had already resulted in a
+            // chain that didn't trigger the assertion below.
+            if (nd->witnessHeight < pindex->nHeight) {
+                assert(nWitnessCacheSize >= nd->witnesses.size());
             }
         }
         if ( SAFECOIN_REWIND == 0 )
@@ -825,6 +933,28 @@ void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
     }
 }
 
+/**
+ * Disconnects pindex, which ScanForWalletTransactions has not reached yet,
+ * from the witnesses of notes that were already witnessed up to it before
+ * the rescan started. Notes found by the rescan are left alone, and so is
+ * nWitnessCacheSize, which stays an upper bound on the cache sizes.
+ */
+void CWallet::DecrementNoteWitnessesAboveRescan(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_wallet);
+    for (const JSOutPoint& jsoutpt : setLiveNotes) {
+        CNoteData* nd = &(mapWallet[jsoutpt.hash].mapNoteData[jsoutpt]);
+        if (nd->witnessHeight >= pindex->nHeight) {
+            // Blocks are disconnected from the tip downwards
+            assert(nd->witnessHeight == pindex->nHeight);
+            if (nd->witnesses.size() > 0) {
+                nd->witnesses.pop_front();
+            }
+            nd->witnessHeight = pindex->nHeight - 1;
+        }
+    }
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -931,7 +1061,6 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
 CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
 {
     AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
 
     // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
     TxItems txOrdered;
@@ -944,7 +1073,12 @@ CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries,
         txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
     }
     acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
+    // Inside a batch read through its handle, as a cursor of another handle
+    // would wait forever on the page locks of the batch's open transaction
+    if (pwalletdbBatch)
+        pwalletdbBatch->ListAccountCreditDebit(strAccount, acentries);
+    else
+        CWalletDB(strWalletFile).ListAccountCreditDebit(strAccount, acentries);
     BOOST_FOREACH(CAccountingEntry& entry, acentries)
     {
         txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
@@ -959,6 +1093,24 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        nWalletUpdates++;
+        // Outputs may have become ours
+        ResetUnspentTxs();
+    }
+}
+
+void CWallet::MarkTxDirty(CWalletTx& wtx)
+{
+    wtx.MarkDirty();
+    nWalletUpdates++;
+}
+
+void CWallet::ResetUnspentTxs()
+{
+    AssertLockHeld(cs_wallet);
+    setUnspentTxs.clear();
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        setUnspentTxs.insert(setUnspentTxs.end(), item.first);
     }
 }
 
@@ -973,10 +1125,15 @@ bool CWallet::UpdateNullifierNoteMap()
         if (IsLocked())
             return false;
 
+        // Nullifiers derived here are written back straight away, so that
+        // they don't have to be derived again on the next start
+        CWalletDBBatch batch(this, false);
         ZCNoteDecryption dec;
         for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            bool fDerived = false;
             for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
                 if (!item.second.nullifier) {
+                    fDerived = true;
                     auto i = item.first.js;
                     GetNoteDecryptor(item.second.address, dec);
                     auto hSig = wtxItem.second.vjoinsplit[i].h_sig(
@@ -990,6 +1147,12 @@ bool CWallet::UpdateNullifierNoteMap()
                 }
             }
             UpdateNullifierNoteMapWithTx(wtxItem.second);
+            if (fDerived) {
+                // The notes may turn out to be spent
+                nWalletUpdates++;
+                if (fFileBacked)
+                    batch.Get().WriteTx(wtxItem.first, wtxItem.second);
+            }
         }
     }
     return true;
@@ -1019,7 +1182,10 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+        AddToLiveNotes(mapWallet[hash]);
         AddToSpends(hash);
+        setUnspentTxs.insert(hash);
+        nWalletUpdates++;
     }
     else
     {
@@ -1108,6 +1274,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        AddToLiveNotes(wtx);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -1117,7 +1285,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                 return false;
 
         // Break debit/credit balance caches:
-        wtx.MarkDirty();
+        MarkTxDirty(wtx);
+        setUnspentTxs.insert(hash);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1144,8 +1313,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
     // Ensure we keep any cached witnesses we may already have
     for (const std::pair<JSOutPoint, CNoteData> nd : wtx.mapNoteData) {
         if (tmp.count(nd.first) && nd.second.witnesses.size() > 0) {
-            tmp.at(nd.first).witnesses.assign(
-                nd.second.witnesses.cbegin(), nd.second.witnesses.cend());
+            tmp.at(nd.first).witnesses = nd.second.witnesses;
         }
         tmp.at(nd.first).witnessHeight = nd.second.witnessHeight;
     }
@@ -1159,13 +1327,18 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * pblock is optional, but should be provided if the transaction is known to be in a block.
  * If fUpdate is true, existing transactions will be updated.
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+/**
+ * pNoteData, if given, is the result of FindMyNotes(tx), computed in advance
+ * by the caller.
+ */
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate,
+                                       const mapNoteData_t* pNoteData)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto noteData = FindMyNotes(tx);
+        auto noteData = pNoteData ? *pNoteData : FindMyNotes(tx);
         if (fExisted || IsMine(tx) || IsFromMe(tx) || noteData.size() > 0)
         {
             CWalletTx wtx(this,tx);
@@ -1178,6 +1351,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
 
+            if (pwalletdbBatch)
+                return AddToWallet(wtx, false, pwalletdbBatch);
+
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
             CWalletDB walletdb(strWalletFile, "r+", false);
@@ -1188,10 +1364,39 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
     return false;
 }
 
+namespace {
+
+//! Trial decryptions (JoinSplits x decryptors) per thread in FindMyNotesInBlock
+const size_t TRIAL_DECRYPTIONS_PER_THREAD = 64;
+
+//! Number of trial-decryption threads set by -rescanthreads
+int GetScanThreads()
+{
+    int nScanThreads = GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+    if (nScanThreads <= 0)
+        nScanThreads += boost::thread::hardware_concurrency();
+    return std::max(1, std::min(MAX_RESCAN_THREADS, nScanThreads));
+}
+
+}
+
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
     LOCK2(cs_main, cs_wallet);
-    if (!AddToWalletIfInvolvingMe(tx, pblock, true))
+    const mapNoteData_t* pNoteData = NULL;
+    if (pblock) {
+        // Blocks are synced one transaction at a time, so trial-decrypt the
+        // whole block in parallel when its first transaction comes in
+        uint256 hashBlock = pblock->GetHash();
+        if (hashBlock != hashSyncBlock) {
+            mapSyncNoteData = FindMyNotesInBlock(*pblock, GetScanThreads());
+            hashSyncBlock = hashBlock;
+        }
+        std::map<uint256, mapNoteData_t>::const_iterator it = mapSyncNoteData.find(tx.GetHash());
+        if (it != mapSyncNoteData.end())
+            pNoteData = &it->second;
+    }
+    if (!AddToWalletIfInvolvingMe(tx, pblock, true, pNoteData))
         return; // Not one of ours
 
     MarkAffectedTransactionsDirty(tx);
@@ -1205,13 +1410,13 @@ void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
         if (mapWallet.count(txin.prevout.hash))
-            mapWallet[txin.prevout.hash].MarkDirty();
+            MarkTxDirty(mapWallet[txin.prevout.hash]);
     }
     for (const JSDescription& jsdesc : tx.vjoinsplit) {
         for (const uint256& nullifier : jsdesc.nullifiers) {
             if (mapNullifiersToNotes.count(nullifier) &&
                     mapWallet.count(mapNullifiersToNotes[nullifier].hash)) {
-                mapWallet[mapNullifiersToNotes[nullifier].hash].MarkDirty();
+                MarkTxDirty(mapWallet[mapNullifiersToNotes[nullifier].hash]);
             }
         }
     }
@@ -1223,8 +1428,17 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        std::map<uint256, CWalletTx>::iterator it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            for (const mapNoteData_t::value_type& item : it->second.mapNoteData) {
+                setLiveNotes.erase(item.first);
+            }
+            mapWallet.erase(it);
             CWalletDB(strWalletFile).EraseTx(hash);
+            // Outputs it spent are unspent again
+            ResetUnspentTxs();
+            nWalletUpdates++;
+        }
     }
     return;
 }
@@ -1267,31 +1481,47 @@ boost::optional<uint256> CWallet::GetNoteNullifier(const JSDescription& jsdesc,
 mapNoteData_t CWallet::FindMyNotes(const CTransaction& tx) const
 {
     LOCK(cs_SpendingKeyStore);
+    return FindMyNotes(tx, mapNoteDecryptors);
+}
+
+/**
+ * As FindMyNotes(tx), but trial-decrypts with the given decryptors, so that
+ * the rescan threads can scan transactions without holding
+ * cs_SpendingKeyStore. A single transaction is always scanned serially;
+ * rescans and connected blocks get their parallelism from scanning several
+ * transactions at once.
+ */
+mapNoteData_t CWallet::FindMyNotes(const CTransaction& tx, const NoteDecryptorMap& decryptors) const
+{
     uint256 hash = tx.GetHash();
 
     mapNoteData_t noteData;
     for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
-        auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
-        for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
+        const JSDescription& jsdesc = tx.vjoinsplit[i];
+        uint256 hSig = jsdesc.h_sig(*pzcashParams, tx.joinSplitPubKey);
+        for (const NoteDecryptorMap::value_type& item : decryptors) {
+            auto plaintexts = item.second.try_decrypt(jsdesc.ciphertexts.data(),
+                                                      jsdesc.ciphertexts.size(),
+                                                      jsdesc.ephemeralKey,
+                                                      hSig);
+            for (uint8_t j = 0; j < plaintexts.size(); j++) {
+                JSOutPoint jsoutpt {hash, i, j};
+                if (!plaintexts[j] || noteData.count(jsoutpt)) {
+                    // Not ours, or claimed by an earlier decryptor
+                    continue;
+                }
+                const PaymentAddress& address = item.first;
                 try {
-                    auto address = item.first;
-                    JSOutPoint jsoutpt {hash, i, j};
-                    auto nullifier = GetNoteNullifier(
-                        tx.vjoinsplit[i],
-                        address,
-                        item.second,
-                        hSig, j);
-                    if (nullifier) {
-                        CNoteData nd {address, *nullifier};
+                    auto note = NotePlaintext(*plaintexts[j]).note(address);
+                    // SpendingKeys are only available if the wallet is unlocked
+                    SpendingKey key;
+                    if (GetSpendingKey(address, key)) {
+                        CNoteData nd {address, note.nullifier(key)};
                         noteData.insert(std::make_pair(jsoutpt, nd));
                     } else {
                         CNoteData nd {address};
                         noteData.insert(std::make_pair(jsoutpt, nd));
                     }
-                    break;
-                } catch (const note_decryption_failed &err) {
-                    // Couldn't decrypt with this decryptor
                 } catch (const std::exception &exc) {
                     // Unexpected failure
                     LogPrintf("FindMyNotes(): Unexpected error while testing decrypt:\n");
@@ -1303,6 +1533,48 @@ mapNoteData_t CWallet::FindMyNotes(const CTransaction& tx) const
     return noteData;
 }
 
+/**
+ * Runs FindMyNotes on every transaction of a block that has JoinSplits, on
+ * up to nThreads threads that each take the next transaction not yet
+ * scanned. Returns the notes found by transaction hash.
+ */
+std::map<uint256, mapNoteData_t> CWallet::FindMyNotesInBlock(const CBlock& block, int nThreads) const
+{
+    NoteDecryptorMap decryptors;
+    {
+        LOCK(cs_SpendingKeyStore);
+        decryptors = mapNoteDecryptors;
+    }
+
+    std::vector<const CTransaction*> vScan;
+    size_t nTrials = 0;
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.vjoinsplit.empty()) {
+            vScan.push_back(&tx);
+            nTrials += tx.vjoinsplit.size() * decryptors.size();
+        }
+    }
+
+    // Only start threads when there is enough work to share out
+    nThreads = std::max<int>(1, std::min<size_t>(nThreads, nTrials / TRIAL_DECRYPTIONS_PER_THREAD));
+    std::vector<mapNoteData_t> vNoteData(vScan.size());
+    std::atomic<size_t> nNext(0);
+    auto scan = [&]() {
+        for (size_t i = nNext++; i < vScan.size(); i = nNext++)
+            vNoteData[i] = FindMyNotes(*vScan[i], decryptors);
+    };
+    boost::thread_group threads;
+    for (int t = 1; t < nThreads; t++)
+        threads.create_thread(scan);
+    scan();
+    threads.join_all();
+
+    std::map<uint256, mapNoteData_t> ret;
+    for (size_t i = 0; i < vScan.size(); i++)
+        ret.insert(std::make_pair(vScan[i]->GetHash(), vNoteData[i]));
+    return ret;
+}
+
 bool CWallet::IsFromMe(const uint256& nullifier) const
 {
     {
@@ -1344,6 +1616,46 @@ void CWallet::GetNoteWitnesses(std::vector<JSOutPoint> notes,
     }
 }
 
+/**
+ * Take a snapshot of the witnesses of the given notes, together with their
+ * common anchor and the commitment tree at that anchor. With no notes the
+ * snapshot is taken at the best anchor of the chain. Notes without a witness
+ * are left out. Returns false if the witnesses are not all at the same tree
+ * state.
+ */
+bool CWallet::GetNoteWitnessSnapshot(const std::vector<JSOutPoint>& notes, CNoteWitnessSnapshot& snapshot)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    snapshot = CNoteWitnessSnapshot();
+    snapshot.nHeight = chainActive.Height();
+
+    boost::optional<uint256> rt;
+    for (const JSOutPoint& jsop : notes) {
+        auto it = mapWallet.find(jsop.hash);
+        if (it == mapWallet.end()) {
+            continue;
+        }
+        auto nd = it->second.mapNoteData.find(jsop);
+        if (nd == it->second.mapNoteData.end() || nd->second.witnesses.empty()) {
+            continue;
+        }
+        const ZCIncrementalWitness& witness = nd->second.witnesses.front();
+        if (!rt) {
+            rt = witness.root();
+        } else if (*rt != witness.root()) {
+            return false;
+        }
+        snapshot.witnesses.insert(std::make_pair(jsop, witness));
+
+        BlockMap::const_iterator mi = mapBlockIndex.find(it->second.hashBlock);
+        snapshot.noteHeights[jsop] = (mi != mapBlockIndex.end() && mi->second) ? mi->second->nHeight : -1;
+    }
+
+    snapshot.anchor = rt ? *rt : pcoinsTip->GetBestAnchor();
+    return pcoinsTip->GetAnchorAt(snapshot.anchor, snapshot.tree);
+}
+
 isminetype CWallet::IsMine(const CTxIn &txin) const
 {
     {
@@ -1759,52 +2071,255 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  */
+namespace {
+
+/** A block queued for a wallet rescan, with the notes found in each transaction. */
+struct CRescanBlock
+{
+    const CBlockIndex* pindex;
+    CBlock block;
+    std::vector<mapNoteData_t> vNoteData;
+    bool fScanned;
+
+    CRescanBlock(const CBlockIndex* pindexIn) : pindex(pindexIn), fScanned(false) {}
+};
+
+/**
+ * Reads blocks ahead of a wallet rescan on one thread and trial-decrypts
+ * their notes on a pool of worker threads. Blocks are handed back in the
+ * order they were queued. None of this touches chain or wallet state, so it
+ * runs without cs_main or cs_wallet.
+ */
+class CRescanPipeline
+{
+private:
+    const CWallet& wallet;
+    const NoteDecryptorMap decryptors;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! Queued blocks; queue[0, nRead) are read and queue[0, nClaimed) taken by a worker
+    std::deque<std::shared_ptr<CRescanBlock>> queue;
+    size_t nRead;
+    size_t nClaimed;
+    bool fStop;
+    boost::thread_group threads;
+
+    void ReadThread()
+    {
+        RenameThread("zcash-rescanread");
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            while (!fStop && nRead >= queue.size())
+                cond.wait(lock);
+            if (fStop)
+                return;
+            std::shared_ptr<CRescanBlock> item = queue[nRead];
+            lock.unlock();
+            // Block positions are fixed once a block is stored, and block
+            // index entries are never freed, so no cs_main is needed here.
+            if (!ReadBlockFromDisk(item->block, item->pindex))
+                LogPrintf("%s: failed to read block %s\n", __func__, item->pindex->GetBlockHash().ToString());
+            lock.lock();
+            // Clear() may have emptied the queue while we were reading
+            if (nRead < queue.size() && queue[nRead] == item) {
+                nRead++;
+                cond.notify_all();
+            }
+        }
+    }
+
+    void ScanThread()
+    {
+        RenameThread("zcash-rescan");
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            while (!fStop && nClaimed >= nRead)
+                cond.wait(lock);
+            if (fStop)
+                return;
+            std::shared_ptr<CRescanBlock> item = queue[nClaimed++];
+            lock.unlock();
+            item->vNoteData.resize(item->block.vtx.size());
+            for (size_t i = 0; i < item->block.vtx.size(); i++)
+                item->vNoteData[i] = wallet.FindMyNotes(item->block.vtx[i], decryptors);
+            lock.lock();
+            item->fScanned = true;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CRescanPipeline(const CWallet& walletIn, const NoteDecryptorMap& decryptorsIn, int nScanThreads) :
+        wallet(walletIn), decryptors(decryptorsIn), nRead(0), nClaimed(0), fStop(false)
+    {
+        threads.create_thread(boost::bind(&CRescanPipeline::ReadThread, this));
+        for (int i = 0; i < nScanThreads; i++)
+            threads.create_thread(boost::bind(&CRescanPipeline::ScanThread, this));
+    }
+
+    ~CRescanPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        threads.join_all();
+    }
+
+    void Push(const CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.push_back(std::make_shared<CRescanBlock>(pindex));
+        cond.notify_all();
+    }
+
+    size_t Size()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return queue.size();
+    }
+
+    /** Drops all queued blocks, e.g. after a reorg. */
+    void Clear()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.clear();
+        nRead = nClaimed = 0;
+    }
+
+    /**
+     * Waits for the first queued block to be scanned, then takes it and up
+     * to nMax - 1 following blocks that are already scanned.
+     */
+    void Pop(size_t nMax, std::vector<std::shared_ptr<CRescanBlock>>& vOut)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!queue.empty() && !queue.front()->fScanned)
+            cond.wait(lock);
+        while (!queue.empty() && queue.front()->fScanned && vOut.size() < nMax) {
+            vOut.push_back(queue.front());
+            queue.pop_front();
+            nRead--;
+            nClaimed--;
+        }
+    }
+};
+
+}
+
+/**
+ * Scan the block chain (starting in pindexStart) for transactions
+ * from or to us. If fUpdate is true, found transactions that already
+ * exist in the wallet will be updated.
+ *
+ * Blocks are read and trial-decrypted ahead by a CRescanPipeline, and
+ * added to the wallet in order, WALLET_RESCAN_CHUNK blocks per hold of
+ * cs_main and cs_wallet, so the node keeps processing blocks and requests
+ * between chunks. Must be called without cs_main or cs_wallet held.
+ */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    LOCK(cs_rescan);
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
-    CBlockIndex* pindex = pindexStart;
+    int nScanThreads = GetScanThreads();
+
+    NoteDecryptorMap decryptors;
+    {
+        LOCK(cs_SpendingKeyStore);
+        decryptors = mapNoteDecryptors;
+    }
+    CRescanPipeline pipeline(*this, decryptors, nScanThreads);
+
+    double dProgressStart, dProgressTip;
+    int nFeedHeight;
     {
         LOCK2(cs_main, cs_wallet);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
+        CBlockIndex* pindex = pindexStart;
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
+        if (!pindex)
+            return ret;
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
-        {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+        fRescanning = true;
+        nRescanHeight = pindex->nHeight - 1;
+        nFeedHeight = pindex->nHeight;
+    }
+
+    std::vector<std::shared_ptr<CRescanBlock>> vReady;
+    try {
+        while (true)
+        {
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
+                LOCK2(cs_main, cs_wallet);
+                // Write the transactions found in this chunk of blocks in one
+                // database transaction. As in AddToWalletIfInvolvingMe, don't
+                // flush: after a crash SetBestChain makes startup rescan them.
+                CWalletDBBatch batch(this, false);
 
-            ZCIncrementalMerkleTree tree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetAnchorAt(pindex->hashAnchor, tree));
-            // Increment note witness caches
-            IncrementNoteWitnesses(pindex, &block, tree);
+                for (const std::shared_ptr<CRescanBlock>& item : vReady)
+                {
+                    CBlockIndex* pindex = chainActive[nRescanHeight + 1];
+                    if (pindex != item->pindex) {
+                        // The chain moved under us; start again from where it forked
+                        pipeline.Clear();
+                        break;
+                    }
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                    if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                        ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                    const CBlock& block = item->block;
+                    for (size_t i = 0; i < block.vtx.size(); i++)
+                    {
+                        if (AddToWalletIfInvolvingMe(block.vtx[i], &block, fUpdate, &item->vNoteData[i]))
+                            ret++;
+                    }
+
+                    ZCIncrementalMerkleTree tree;
+                    // This should never fail: we should always be able to get the tree
+                    // state on the path to the tip of our chain
+                    assert(pcoinsTip->GetAnchorAt(pindex->hashAnchor, tree));
+                    // Increment note witness caches
+                    IncrementNoteWitnesses(pindex, &block, tree);
+                    nRescanHeight = pindex->nHeight;
+
+                    if (GetTime() >= nNow + 60) {
+                        nNow = GetTime();
+                        LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                    }
+                }
+                vReady.clear();
+
+                if (pipeline.Size() == 0)
+                    nFeedHeight = nRescanHeight + 1;
+                while (nFeedHeight <= chainActive.Height() && pipeline.Size() < WALLET_RESCAN_READ_AHEAD)
+                    pipeline.Push(chainActive[nFeedHeight++]);
+                if (pipeline.Size() == 0) {
+                    // Caught up with the tip while holding cs_main
+                    fRescanning = false;
+                    break;
+                }
             }
+            pipeline.Pop(WALLET_RESCAN_CHUNK, vReady);
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+    } catch (...) {
+        LOCK(cs_wallet);
+        fRescanning = false;
+        throw;
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -2111,94 +2626,169 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
  */
 
 
-CAmount CWallet::GetBalance() const
+/**
+ * Spends of the outputs of wtx buried deeper than WITNESS_CACHE_SIZE are
+ * treated as final, like the note witnesses are.
+ */
+bool CWallet::IsSpentBeyondReorg(const CWalletTx& wtx) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    uint256 hashTx = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) == ISMINE_NO)
+            continue;
+        bool fSpent = false;
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+        range = mapTxSpends.equal_range(COutPoint(hashTx, i));
+        for (TxSpends::const_iterator it = range.first; it != range.second && !fSpent; ++it) {
+            std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+            fSpent = mit != mapWallet.end() &&
+                     mit->second.GetDepthInMainChain() > (int)WITNESS_CACHE_SIZE;
         }
+        if (!fSpent)
+            return false;
     }
-
-    return nTotal;
+    return true;
 }
 
-CAmount CWallet::GetUnconfirmedBalance() const
+/**
+ * Returns the wallet balances, recomputing them only if the chain tip, the
+ * wallet, or (while transactions are unconfirmed) the mempool has changed
+ * since they were last computed.
+ */
+const CWalletBalances& CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    uint256 hashTip = chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256();
+    unsigned int nMempoolUpdates = mempool.GetTransactionsUpdated();
+    if (balances.fValid && balances.hashTip == hashTip &&
+            balances.nWalletUpdates == nWalletUpdates &&
+            (!balances.fUnconfirmed || balances.nMempoolUpdates == nMempoolUpdates)) {
+        return balances;
+    }
+
+    CWalletBalances updated;
+    updated.fValid = true;
+    updated.hashTip = hashTip;
+    updated.nWalletUpdates = nWalletUpdates;
+    updated.nMempoolUpdates = nMempoolUpdates;
+    for (std::set<uint256>::const_iterator it = setUnspentTxs.begin(); it != setUnspentTxs.end(); )
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(*it);
+        if (mit == mapWallet.end() || IsSpentBeyondReorg(mit->second)) {
+            setUnspentTxs.erase(it++);
+            continue;
+        }
+        const CWalletTx* pcoin = &(mit->second);
+        bool fFinal = CheckFinalTx(*pcoin);
+        bool fTrusted = pcoin->IsTrusted();
+        int nDepth = pcoin->GetDepthInMainChain();
+        if (!fFinal || nDepth == 0)
+            updated.fUnconfirmed = true;
+
+        if (fTrusted) {
+            updated.nBalance += pcoin->GetAvailableCredit();
+            updated.nWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
         }
+        if (!fFinal || (!fTrusted && nDepth == 0)) {
+            updated.nUnconfirmed += pcoin->GetAvailableCredit();
+            updated.nUnconfirmedWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        updated.nImmature += pcoin->GetImmatureCredit();
+        updated.nImmatureWatchOnly += pcoin->GetImmatureWatchOnlyCredit();
+        ++it;
     }
-    return nTotal;
+    balances = updated;
+    return balances;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nBalance;
+}
+
+CAmount CWallet::GetUnconfirmedBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nImmatureWatchOnly;
+}
+
+/**
+ * Returns the total of the unspent notes with at least minDepth
+ * confirmations. It is kept with the transparent totals, and while a live
+ * note or a spend of one is unconfirmed it also depends on the mempool.
+ */
+CAmount CWallet::GetPrivateBalance(int minDepth)
+{
+    LOCK2(cs_main, cs_wallet);
+    GetBalances();
+    unsigned int nMempoolUpdates = mempool.GetTransactionsUpdated();
+    if (balances.fPrivateValid && balances.nPrivateMinDepth == minDepth &&
+            (!balances.fPrivateUnconfirmed || balances.nPrivateMempoolUpdates == nMempoolUpdates)) {
+        return balances.nPrivate;
+    }
+
+    std::vector<CNotePlaintextEntry> entries;
+    GetFilteredNotes(entries, "", minDepth);
+    CAmount nPrivate = 0;
+    for (const CNotePlaintextEntry& entry : entries) {
+        nPrivate += CAmount(entry.plaintext.value);
+    }
+
+    bool fUnconfirmed = false;
+    for (std::set<JSOutPoint>::const_iterator it = setLiveNotes.begin(); it != setLiveNotes.end() && !fUnconfirmed; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->hash);
+        if (mit == mapWallet.end())
+            continue;
+        if (mit->second.GetDepthInMainChain() <= 0) {
+            fUnconfirmed = true;
+            break;
+        }
+        mapNoteData_t::const_iterator nit = mit->second.mapNoteData.find(*it);
+        if (nit == mit->second.mapNoteData.end() || !nit->second.nullifier)
+            continue;
+        pair<TxNullifiers::const_iterator, TxNullifiers::const_iterator> range;
+        range = mapTxNullifiers.equal_range(*nit->second.nullifier);
+        for (TxNullifiers::const_iterator sit = range.first; sit != range.second; ++sit) {
+            std::map<uint256, CWalletTx>::const_iterator smit = mapWallet.find(sit->second);
+            if (smit != mapWallet.end() && smit->second.GetDepthInMainChain() <= 0)
+                fUnconfirmed = true;
         }
     }
-    return nTotal;
+
+    balances.fPrivateValid = true;
+    balances.nPrivateMinDepth = minDepth;
+    balances.fPrivateUnconfirmed = fUnconfirmed;
+    balances.nPrivateMempoolUpdates = nMempoolUpdates;
+    balances.nPrivate = nPrivate;
+    return nPrivate;
 }
 
 /**
@@ -2214,8 +2804,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (std::set<uint256>::const_iterator uit = setUnspentTxs.begin(); uit != setUnspentTxs.end(); ++uit)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(*uit);
+            if (it == mapWallet.end())
+                continue;
             const uint256& wtxid = it->first;
             const CWalletTx* pcoin = &(*it).second;
 
@@ -2290,6 +2883,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
+//! Above this many candidate coins SelectCoinsMinConf doesn't use ApproximateBestSubset
+static const unsigned int MAX_STOCHASTIC_SELECT_COINS = 1000;
+
 static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -2335,6 +2931,84 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
+/**
+ * Depth first search, largest coins first, for a set of coins adding up to
+ * exactly nTargetValue, so that no change output is needed. vValue must be
+ * sorted by descending value. Each step is constant time, and the search
+ * gives up after nMaxTries steps.
+ */
+static bool SelectCoinsExactMatch(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTargetValue, vector<char>& vfBest, int nMaxTries = 100000)
+{
+    // vRemaining[i] is the total value of the coins from i on, and
+    // vNextValue[i] the first coin after i of a smaller value
+    vector<CAmount> vRemaining(vValue.size() + 1, 0);
+    vector<size_t> vNextValue(vValue.size(), vValue.size());
+    for (size_t i = vValue.size(); i-- > 0; )
+    {
+        vRemaining[i] = vRemaining[i + 1] + vValue[i].first;
+        if (i + 1 < vValue.size())
+            vNextValue[i] = vValue[i + 1].first == vValue[i].first ? vNextValue[i + 1] : i + 1;
+    }
+
+    // The coins in the current branch, in the order they were added
+    vector<size_t> vIncluded;
+    CAmount nTotal = 0;
+    size_t i = 0;
+    for (int nTries = 0; nTries < nMaxTries; nTries++)
+    {
+        if (nTotal == nTargetValue)
+        {
+            vfBest.assign(vValue.size(), false);
+            for (size_t j = 0; j < vIncluded.size(); j++)
+                vfBest[vIncluded[j]] = true;
+            return true;
+        }
+        if (i < vValue.size() && nTotal < nTargetValue && nTotal + vRemaining[i] >= nTargetValue)
+        {
+            // Try with the next coin
+            vIncluded.push_back(i);
+            nTotal += vValue[i++].first;
+            continue;
+        }
+
+        // Dead end: take out the last coin added and carry on without it.
+        // Coins of the same value would only repeat the branch just searched.
+        if (vIncluded.empty())
+            return false;
+        size_t nLast = vIncluded.back();
+        vIncluded.pop_back();
+        nTotal -= vValue[nLast].first;
+        i = vNextValue[nLast];
+    }
+    return false;
+}
+
+/**
+ * Selects the largest coins until nTargetValue is reached, then leaves out
+ * any that the rest already cover. Linear in the number of coins, for when
+ * there are too many for ApproximateBestSubset. vValue must be sorted by
+ * descending value and add up to at least nTargetValue.
+ */
+static void SelectCoinsLargestFirst(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTargetValue, vector<char>& vfBest, CAmount& nBest)
+{
+    vfBest.assign(vValue.size(), false);
+    nBest = 0;
+    size_t nSelected = 0;
+    while (nSelected < vValue.size() && nBest < nTargetValue)
+    {
+        vfBest[nSelected] = true;
+        nBest += vValue[nSelected++].first;
+    }
+    for (size_t i = nSelected; i-- > 0; )
+    {
+        if (nBest - vValue[i].first >= nTargetValue)
+        {
+            vfBest[i] = false;
+            nBest -= vValue[i].first;
+        }
+    }
+}
+
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     int32_t count = 0; //uint64_t lowest_interest = 0;
@@ -2419,14 +3093,27 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    if (SelectCoinsExactMatch(vValue, nTargetValue, vfBest))
+    {
+        nBest = nTargetValue;
+    }
+    else if (vValue.size() > MAX_STOCHASTIC_SELECT_COINS)
+    {
+        // The stochastic approximation costs iterations x coins; with this
+        // many small coins, take the largest ones instead
+        SelectCoinsLargestFirst(vValue, nTotalLower >= nTargetValue + CENT ? nTargetValue + CENT : nTargetValue, vfBest, nBest);
+    }
+    else
+    {
+        // Solve subset sum by stochastic approximation
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -2468,8 +3155,11 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
     //    *interestp = 0;
     //}
     vector<COutput> vCoinsNoCoinbase, vCoinsWithCoinbase;
-    AvailableCoins(vCoinsNoCoinbase, true, coinControl, false, false);
     AvailableCoins(vCoinsWithCoinbase, true, coinControl, false, true);
+    for (const COutput& out : vCoinsWithCoinbase) {
+        if (!out.tx->IsCoinBase())
+            vCoinsNoCoinbase.push_back(out);
+    }
     fOnlyCoinbaseCoinsRet = vCoinsNoCoinbase.size() == 0 && vCoinsWithCoinbase.size() > 0;
 
     // If coinbase utxos can only be sent to zaddrs, exclude any coinbase utxos from coin selection.
@@ -3065,6 +3755,11 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW) );
     if (!fFileBacked)
         return false;
+    if (pwalletdbBatch) {
+        if (!strPurpose.empty() && !pwalletdbBatch->WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
+            return false;
+        return pwalletdbBatch->WriteName(CBitcoinAddress(address).ToString(), strName);
+    }
     if (!strPurpose.empty() && !CWalletDB(strWalletFile).WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
         return false;
     return CWalletDB(strWalletFile).WriteName(CBitcoinAddress(address).ToString(), strName);
@@ -3114,7 +3809,8 @@ bool CWallet::NewKeyPool()
 {
     {
         LOCK(cs_wallet);
-        CWalletDB walletdb(strWalletFile);
+        CWalletDBBatch batch(this);
+        CWalletDB& walletdb = batch.Get();
         BOOST_FOREACH(int64_t nIndex, setKeyPool)
             walletdb.ErasePool(nIndex);
         setKeyPool.clear();
@@ -3142,7 +3838,8 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
+        CWalletDBBatch batch(this);
+        CWalletDB& walletdb = batch.Get();
 
         // Top up key pool
         unsigned int nTargetSize;
@@ -3390,6 +4087,29 @@ std::set<CTxDestination> CWallet::GetAccountAddresses(const std::string& strAcco
     return result;
 }
 
+CWalletDBBatch::CWalletDBBatch(CWallet* pwalletIn, bool fFlushOnClose) :
+    pwallet(pwalletIn), walletdb(pwalletIn->strWalletFile, "r+", fFlushOnClose), pwalletdb(&walletdb), fOwner(false)
+{
+    AssertLockHeld(pwallet->cs_wallet);
+    if (pwallet->pwalletdbBatch) {
+        // Nested: keep using the enclosing batch, as writes through a second
+        // handle could wait on the locks of its open transaction
+        pwalletdb = pwallet->pwalletdbBatch;
+    } else if (walletdb.BatchBegin(WALLET_DB_BATCH_SIZE)) {
+        pwallet->pwalletdbBatch = &walletdb;
+        fOwner = true;
+    }
+}
+
+CWalletDBBatch::~CWalletDBBatch()
+{
+    if (fOwner) {
+        pwallet->pwalletdbBatch = NULL;
+        if (!walletdb.BatchEnd())
+            LogPrintf("CWalletDBBatch: failed to commit batched wallet writes\n");
+    }
+}
+
 bool CReserveKey::GetReservedKey(CPubKey& pubkey)
 {
     if (nIndex == -1)
@@ -3736,62 +4456,84 @@ void CWallet::GetFilteredNotes(std::vector<CNotePlaintextEntry> & outEntries, st
 
     LOCK2(cs_main, cs_wallet);
 
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    // Filter the transactions before checking for notes
+    auto txSelected = [&](const CWalletTx& wtx) {
+        return CheckFinalTx(wtx) && wtx.GetBlocksToMaturity() <= 0 && wtx.GetDepthInMainChain() >= minDepth;
+    };
 
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < minDepth) {
-            continue;
+    auto addNote = [&](const CWalletTx& wtx, const JSOutPoint& jsop, const CNoteData& nd) {
+        PaymentAddress pa = nd.address;
+
+        // skip notes which belong to a different payment address in the wallet
+        if (fFilterAddress && !(pa == filterPaymentAddress)) {
+            return;
         }
 
-        if (wtx.mapNoteData.size() == 0) {
-            continue;
+        // skip note which has been spent
+        if (ignoreSpent && nd.nullifier && IsSpent(*nd.nullifier)) {
+            return;
         }
 
-        for (auto & pair : wtx.mapNoteData) {
-            JSOutPoint jsop = pair.first;
-            CNoteData nd = pair.second;
-            PaymentAddress pa = nd.address;
+        int i = jsop.js; // Index into CTransaction.vjoinsplit
+        int j = jsop.n; // Index into JSDescription.ciphertexts
 
-            // skip notes which belong to a different payment address in the wallet
-            if (fFilterAddress && !(pa == filterPaymentAddress)) {
-                continue;
-            }
+        // Get cached decryptor
+        ZCNoteDecryption decryptor;
+        if (!GetNoteDecryptor(pa, decryptor)) {
+            // Note decryptors are created when the wallet is loaded, so it should always exist
+            throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", CZCPaymentAddress(pa).ToString()));
+        }
 
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSpent(*nd.nullifier)) {
+        // determine amount of funds in the note
+        auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
+        try {
+            NotePlaintext plaintext = NotePlaintext::decrypt(
+                    decryptor,
+                    wtx.vjoinsplit[i].ciphertexts[j],
+                    wtx.vjoinsplit[i].ephemeralKey,
+                    hSig,
+                    (unsigned char) j);
+
+            outEntries.push_back(CNotePlaintextEntry{jsop, plaintext});
+
+        } catch (const note_decryption_failed &err) {
+            // Couldn't decrypt with this spending key
+            throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", CZCPaymentAddress(pa).ToString()));
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", CZCPaymentAddress(pa).ToString(), exc.what()));
+        }
+    };
+
+    if (ignoreSpent) {
+        // Notes that left setLiveNotes are spent, so only the live ones are
+        // looked at. The set is ordered by transaction.
+        uint256 hashTx;
+        const CWalletTx* pwtx = NULL;
+        for (const JSOutPoint& jsop : setLiveNotes) {
+            if (jsop.hash != hashTx) {
+                hashTx = jsop.hash;
+                std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(hashTx);
+                pwtx = mit != mapWallet.end() && txSelected(mit->second) ? &mit->second : NULL;
+            }
+            if (!pwtx) {
                 continue;
             }
-
-            int i = jsop.js; // Index into CTransaction.vjoinsplit
-            int j = jsop.n; // Index into JSDescription.ciphertexts
-
-            // Get cached decryptor
-            ZCNoteDecryption decryptor;
-            if (!GetNoteDecryptor(pa, decryptor)) {
-                // Note decryptors are created when the wallet is loaded, so it should always exist
-                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", CZCPaymentAddress(pa).ToString()));
+            mapNoteData_t::const_iterator nit = pwtx->mapNoteData.find(jsop);
+            if (nit != pwtx->mapNoteData.end()) {
+                addNote(*pwtx, jsop, nit->second);
             }
+        }
+        return;
+    }
 
-            // determine amount of funds in the note
-            auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
-            try {
-                NotePlaintext plaintext = NotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vjoinsplit[i].ciphertexts[j],
-                        wtx.vjoinsplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
-
-                outEntries.push_back(CNotePlaintextEntry{jsop, plaintext});
-
-            } catch (const note_decryption_failed &err) {
-                // Couldn't decrypt with this spending key
-                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", CZCPaymentAddress(pa).ToString()));
-            } catch (const std::exception &exc) {
-                // Unexpected failure
-                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", CZCPaymentAddress(pa).ToString(), exc.what()));
-            }
+    for (auto & p : mapWallet) {
+        const CWalletTx& wtx = p.second;
+        if (wtx.mapNoteData.size() == 0 || !txSelected(wtx)) {
+            continue;
+        }
+        for (auto & pair : wtx.mapNoteData) {
+            addNote(wtx, pair.first, pair.second);
         }
     }
 }
@@ -25,6 +25,7 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <boost/circular_buffer.hpp>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -55,11 +56,24 @@ static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+// transaction.h comment: spending taddr output requires CTxIn >= 148 bytes and typical taddr txout is 34 bytes
+#define CTXIN_SPEND_DUST_SIZE   148
+#define CTXOUT_REGULAR_SIZE     34
 //! Size of witness cache
 //  Should be large enough that we can expect not to reorg beyond our cache
 //  unless there is some exceptional network disruption.
 #define _COINBASE_MATURITY 100
 static const unsigned int WITNESS_CACHE_SIZE = _COINBASE_MATURITY+10;
+//! -rescanthreads default (0 = one per core)
+static const int DEFAULT_RESCAN_THREADS = 0;
+//! Maximum number of trial-decryption threads used by a rescan or a connected block
+static const int MAX_RESCAN_THREADS = 16;
+//! Number of blocks a rescan reads and trial-decrypts ahead of the wallet
+static const unsigned int WALLET_RESCAN_READ_AHEAD = 64;
+//! Maximum number of blocks a rescan adds to the wallet per hold of cs_main
+static const unsigned int WALLET_RESCAN_CHUNK = 16;
+//! Maximum number of records written in one batched wallet database transaction
+static const unsigned int WALLET_DB_BATCH_SIZE = 1000;
 
 class CAccountingEntry;
 class CBlockIndex;
@@ -201,6 +215,81 @@ public:
     std::string ToString() const;
 };
 
+/**
+ * Fixed-capacity cache of a note's incremental witnesses, most recent first.
+ * Once WITNESS_CACHE_SIZE witnesses are held, push_front drops the oldest.
+ * Serialized the same way as the std::list it replaces.
+ */
+class WitnessCache : public boost::circular_buffer_space_optimized<ZCIncrementalWitness>
+{
+public:
+    WitnessCache() : boost::circular_buffer_space_optimized<ZCIncrementalWitness>(WITNESS_CACHE_SIZE) { }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        unsigned int nSize = GetSizeOfCompactSize(size());
+        for (const ZCIncrementalWitness& witness : *this) {
+            nSize += ::GetSerializeSize(witness, nType, nVersion);
+        }
+        return nSize;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        WriteCompactSize(s, size());
+        for (const ZCIncrementalWitness& witness : *this) {
+            ::Serialize(s, witness, nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        clear();
+        uint64_t nSize = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nSize; i++) {
+            ZCIncrementalWitness witness;
+            ::Unserialize(s, witness, nType, nVersion);
+            // Drop the oldest witnesses of an oversized cache
+            if (!full()) {
+                push_back(witness);
+            }
+        }
+    }
+};
+
+/**
+ * Balance totals of a wallet, and the state they were computed for.
+ */
+struct CWalletBalances
+{
+    bool fValid;
+    uint256 hashTip;
+    uint64_t nWalletUpdates;
+    //! Set if an unconfirmed transaction was counted, so the totals also
+    //! depend on the mempool
+    bool fUnconfirmed;
+    unsigned int nMempoolUpdates;
+
+    CAmount nBalance;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nWatchOnly;
+    CAmount nUnconfirmedWatchOnly;
+    CAmount nImmatureWatchOnly;
+
+    //! Total of the unspent notes with nPrivateMinDepth confirmations, and
+    //! whether it also depends on the mempool
+    bool fPrivateValid;
+    int nPrivateMinDepth;
+    bool fPrivateUnconfirmed;
+    unsigned int nPrivateMempoolUpdates;
+    CAmount nPrivate;
+
+    CWalletBalances() : fValid(false), nWalletUpdates(0), fUnconfirmed(false), nMempoolUpdates(0),
+        nBalance(0), nUnconfirmed(0), nImmature(0),
+        nWatchOnly(0), nUnconfirmedWatchOnly(0), nImmatureWatchOnly(0),
+        fPrivateValid(false), nPrivateMinDepth(0), fPrivateUnconfirmed(false), nPrivateMempoolUpdates(0), nPrivate(0) { }
+};
+
 class CNoteData
 {
 public:
@@ -222,9 +311,9 @@ public:
 
     /**
      * Cached incremental witnesses for spendable Notes.
-     * Beginning of the list is the most recent witness.
+     * Beginning of the cache is the most recent witness.
      */
-    std::list<ZCIncrementalWitness> witnesses;
+    WitnessCache witnesses;
 
     /**
      * Block height corresponding to the most current witness.
@@ -276,6 +365,21 @@ struct CNotePlaintextEntry
     libzcash::NotePlaintext plaintext;
 };
 
+/**
+ * Copy of the tree state needed to spend a set of notes: a witness for each
+ * note, all against the same anchor, and the note commitment tree at that
+ * anchor. It is taken under a single lock so that JoinSplits can be built
+ * from it without reading the wallet or the chain again.
+ */
+struct CNoteWitnessSnapshot
+{
+    uint256 anchor;
+    ZCIncrementalMerkleTree tree;
+    int nHeight = -1;                           // chain height the snapshot was taken at
+    std::map<JSOutPoint, ZCIncrementalWitness> witnesses;
+    std::map<JSOutPoint, int> noteHeights;      // height of the block containing each note
+};
+
 
 
 /** A transaction with a merkle branch linking it to the block chain. */
@@ -588,6 +692,11 @@ private:
 
     CWalletDB *pwalletdbEncryption;
 
+    //! While set, writes that would each open their own CWalletDB go through
+    //! this batching handle instead (see CWalletDBBatch)
+    CWalletDB *pwalletdbBatch;
+    friend class CWalletDBBatch;
+
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
 
@@ -618,6 +727,57 @@ private:
     void AddToSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Set while ScanForWalletTransactions runs. The rescan releases cs_main
+     * between chunks of blocks, so ChainTip leaves blocks above
+     * nRescanHeight (the last block the rescan added) to the rescan.
+     */
+    bool fRescanning;
+    int nRescanHeight;
+    //! Serializes rescans; taken before cs_main
+    CCriticalSection cs_rescan;
+
+    void DecrementNoteWitnessesAboveRescan(const CBlockIndex* pindex);
+
+    /**
+     * Notes found in the transactions of the block being connected, by
+     * transaction hash. SyncTransaction fills this for the whole block on
+     * its first transaction and ChainTip clears it.
+     */
+    uint256 hashSyncBlock;
+    std::map<uint256, mapNoteData_t> mapSyncNoteData;
+
+    /**
+     * Notes whose witnesses are still maintained. A note leaves this set
+     * once the transaction spending it is buried deeper than the witness
+     * cache, as it can then never be spent again.
+     */
+    std::set<JSOutPoint> setLiveNotes;
+    //! Transactions whose notes left setLiveNotes since SetBestChain last wrote them
+    std::set<uint256> setPrunedNoteTxs;
+
+    void AddToLiveNotes(const CWalletTx& wtx);
+    void PruneSpentNoteWitnesses(const CBlockIndex* pindex);
+
+    /**
+     * Transactions that may still have outputs of ours unspent. The balance
+     * getters and AvailableCoins only look at these. A transaction leaves
+     * this set once all those outputs are spent by transactions buried
+     * deeper than WITNESS_CACHE_SIZE, and every transaction is put back
+     * whenever the wallet is marked dirty (e.g. after a key import, or when
+     * a script or watch-only address is added).
+     */
+    mutable std::set<uint256> setUnspentTxs;
+
+    //! Bumped whenever a transaction's cached credit is invalidated
+    uint64_t nWalletUpdates;
+    mutable CWalletBalances balances;
+
+    void MarkTxDirty(CWalletTx& wtx);
+    void ResetUnspentTxs();
+    bool IsSpentBeyondReorg(const CWalletTx& wtx) const;
+    const CWalletBalances& GetBalances() const;
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -647,9 +807,19 @@ protected:
             LogPrintf("SetBestChain(): Couldn't start atomic write\n");
             return;
         }
+        LOCK(cs_wallet);
         try {
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                if (!walletdb.WriteTx(wtxItem.first, wtxItem.second)) {
+            // Only the witnesses of live notes change from block to block;
+            // every other transaction was written when it last changed.
+            std::set<uint256> setWrite(setPrunedNoteTxs);
+            for (const JSOutPoint& jsop : setLiveNotes) {
+                setWrite.insert(jsop.hash);
+            }
+            for (const uint256& hash : setWrite) {
+                std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+                if (mi == mapWallet.end())
+                    continue;
+                if (!walletdb.WriteTx(mi->first, mi->second)) {
                     LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
                     walletdb.TxnAbort();
                     return;
@@ -677,6 +847,7 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        setPrunedNoteTxs.clear();
     }
 
 private:
@@ -734,12 +905,16 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pwalletdbBatch = NULL;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fRescanning = false;
+        nRescanHeight = -1;
+        nWalletUpdates = 0;
     }
 
     /**
@@ -901,12 +1076,14 @@ public:
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
-    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate,
+                                  const mapNoteData_t* pNoteData = NULL);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<boost::optional<ZCIncrementalWitness>>& witnesses,
          uint256 &final_anchor);
+    bool GetNoteWitnessSnapshot(const std::vector<JSOutPoint>& notes, CNoteWitnessSnapshot& snapshot);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
@@ -917,6 +1094,7 @@ public:
     CAmount GetWatchOnlyBalance() const;
     CAmount GetUnconfirmedWatchOnlyBalance() const;
     CAmount GetImmatureWatchOnlyBalance() const;
+    CAmount GetPrivateBalance(int minDepth = 1);
     bool FundTransaction(CMutableTransaction& tx, CAmount& nFeeRet, int& nChangePosRet, std::string& strFailReason);
     bool CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosRet,
                            std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true);
@@ -946,6 +1124,8 @@ public:
         const uint256& hSig,
         uint8_t n) const;
     mapNoteData_t FindMyNotes(const CTransaction& tx) const;
+    mapNoteData_t FindMyNotes(const CTransaction& tx, const NoteDecryptorMap& decryptors) const;
+    std::map<uint256, mapNoteData_t> FindMyNotesInBlock(const CBlock& block, int nThreads) const;
     bool IsFromMe(const uint256& nullifier) const;
     void GetNoteWitnesses(
          std::vector<JSOutPoint> notes,
@@ -1069,6 +1249,34 @@ public:
     void KeepKey();
 };
 
+/**
+ * Groups the writes a wallet makes while this object is in scope into a few
+ * database transactions, rather than one transaction and log flush per
+ * record. Writes made through Get() and the wallet's own writes of keys,
+ * transactions and address book entries share one batching handle, which is
+ * committed every WALLET_DB_BATCH_SIZE records and when the object goes out
+ * of scope.
+ *
+ * cs_wallet must be held for the whole lifetime of the object, so that no
+ * other thread writes to the wallet while a database transaction is open.
+ */
+class CWalletDBBatch
+{
+private:
+    CWallet* pwallet;
+    CWalletDB walletdb;
+    CWalletDB* pwalletdb;       // the handle in use; an enclosing batch's if nested
+    bool fOwner;
+
+    CWalletDBBatch(const CWalletDBBatch&);
+    void operator=(const CWalletDBBatch&);
+
+public:
+    CWalletDBBatch(CWallet* pwalletIn, bool fFlushOnClose = true);
+    ~CWalletDBBatch();
+
+    CWalletDB& Get() { return *pwalletdb; }
+};
 
 /**
  * Account information.
@@ -48,6 +48,16 @@ NotePlaintext::NotePlaintext(
     r = note.r;
 }
 
+NotePlaintext::NotePlaintext(const ZCNoteDecryption::Plaintext& plaintext)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << plaintext;
+
+    ss >> *this;
+
+    assert(ss.size() == 0);
+}
+
 Note NotePlaintext::note(const PaymentAddress& addr) const
 {
     return Note(addr.a_pk, value, rho, r);
@@ -62,15 +72,7 @@ NotePlaintext NotePlaintext::decrypt(const ZCNoteDecryption& decryptor,
 {
     auto plaintext = decryptor.decrypt(ciphertext, ephemeralKey, h_sig, nonce);
 
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << plaintext;
-
-    NotePlaintext ret;
-    ss >> ret;
-
-    assert(ss.size() == 0);
-
-    return ret;
+    return NotePlaintext(plaintext);
 }
 
 ZCNoteEncryption::Ciphertext NotePlaintext::encrypt(ZCNoteEncryption& encryptor,
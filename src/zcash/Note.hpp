@@ -35,6 +35,9 @@ public:
 
     NotePlaintext(const Note& note, boost::array<unsigned char, ZC_MEMO_SIZE> memo);
 
+    // Parses a plaintext produced by ZCNoteDecryption
+    explicit NotePlaintext(const ZCNoteDecryption::Plaintext& plaintext);
+
     Note note(const PaymentAddress& addr) const;
 
     ADD_SERIALIZE_METHODS;
@@ -135,6 +135,43 @@ typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt
     return plaintext;
 }
 
+template<size_t MLEN>
+std::vector<boost::optional<typename NoteDecryption<MLEN>::Plaintext>> NoteDecryption<MLEN>::try_decrypt
+                                         (const NoteDecryption<MLEN>::Ciphertext *ciphertexts,
+                                          size_t count,
+                                          const uint256 &epk,
+                                          const uint256 &hSig
+                                         ) const
+{
+    std::vector<boost::optional<NoteDecryption<MLEN>::Plaintext>> ret(count);
+    uint256 dhsecret;
+
+    if (crypto_scalarmult(dhsecret.begin(), sk_enc.begin(), epk.begin()) != 0) {
+        // Not a valid point for any key, so nothing decrypts
+        return ret;
+    }
+
+    // The nonce is zero because we never reuse keys
+    unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
+
+    for (size_t i = 0; i < count; i++) {
+        unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
+        KDF(K, dhsecret, epk, pk_enc, hSig, (unsigned char) i);
+
+        NoteDecryption<MLEN>::Plaintext plaintext;
+        if (crypto_aead_chacha20poly1305_ietf_decrypt(plaintext.begin(), NULL,
+                                                 NULL,
+                                                 ciphertexts[i].begin(), NoteDecryption<MLEN>::CLEN,
+                                                 NULL,
+                                                 0,
+                                                 cipher_nonce, K) == 0) {
+            ret[i] = plaintext;
+        }
+    }
+
+    return ret;
+}
+
 template<size_t MLEN>
 uint256 NoteEncryption<MLEN>::generate_privkey(const uint252 &a_sk)
 {
@@ -7,6 +7,8 @@ https://github.com/zcash/zips/blob/master/protocol/protocol.pdf
 #define ZC_NOTE_ENCRYPTION_H_
 
 #include <boost/array.hpp>
+#include <boost/optional.hpp>
+#include <vector>
 #include "uint256.h"
 #include "uint252.h"
 
@@ -70,6 +72,16 @@ public:
                       unsigned char nonce
                      ) const;
 
+    // Trial-decrypts `count` ciphertexts that share `epk` and `hSig`, as the
+    // outputs of one JoinSplit do, using the index of each ciphertext as its
+    // nonce. The DH secret is computed once for all of them, and failures
+    // are reported as empty entries rather than exceptions.
+    std::vector<boost::optional<Plaintext>> try_decrypt(const Ciphertext *ciphertexts,
+                                                        size_t count,
+                                                        const uint256 &epk,
+                                                        const uint256 &hSig
+                                                       ) const;
+
     friend inline bool operator==(const NoteDecryption& a, const NoteDecryption& b) {
         return a.sk_enc == b.sk_enc && a.pk_enc == b.pk_enc;
     }
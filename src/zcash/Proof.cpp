@@ -1,11 +1,14 @@
 #include "Proof.hpp"
 
 #include <boost/static_assert.hpp>
+#include <map>
 #include <mutex>
+#include <vector>
 
 #include "crypto/common.h"
 #include "libsnark/common/default_types/r1cs_ppzksnark_pp.hpp"
 #include "libsnark/zk_proof_systems/ppzksnark/r1cs_ppzksnark/r1cs_ppzksnark.hpp"
+#include "sodium.h"
 
 using namespace libsnark;
 
@@ -16,6 +19,7 @@ typedef alt_bn128_pp::GT_type curve_GT;
 typedef alt_bn128_pp::Fp_type curve_Fr;
 typedef alt_bn128_pp::Fq_type curve_Fq;
 typedef alt_bn128_pp::Fqe_type curve_Fq2;
+typedef alt_bn128_pp::Fqk_type curve_Fq12;
 
 BOOST_STATIC_ASSERT(sizeof(mp_limb_t) == 8);
 
@@ -223,6 +227,18 @@ void initialize_curve_params()
     std::call_once (init_public_params_once_flag, curve_pp::init_public_params);
 }
 
+class ProofBatch {
+public:
+    struct Entry {
+        const r1cs_ppzksnark_verification_key<curve_pp>* vk;
+        const r1cs_ppzksnark_processed_verification_key<curve_pp>* pvk;
+        r1cs_primary_input<curve_Fr> primary_input;
+        r1cs_ppzksnark_proof<curve_pp> proof;
+    };
+
+    std::vector<Entry> entries;
+};
+
 ProofVerifier ProofVerifier::Strict() {
     initialize_curve_params();
     return ProofVerifier(true);
@@ -233,6 +249,126 @@ ProofVerifier ProofVerifier::Disabled() {
     return ProofVerifier(false);
 }
 
+ProofVerifier ProofVerifier::Batch() {
+    initialize_curve_params();
+    return ProofVerifier(true, std::make_shared<ProofBatch>());
+}
+
+// Random 128-bit nonzero scalar used to combine the pairing equations
+// of several proofs; a forged proof survives the combined check with
+// probability about 2^-128.
+static curve_Fr random_batch_scalar()
+{
+    bigint<curve_Fr::num_limbs> b;
+    for (size_t i = 0; i < curve_Fr::num_limbs; i++) {
+        b.data[i] = 0;
+    }
+    randombytes_buf(b.data, 16);
+    if (b.data[0] == 0 && b.data[1] == 0) {
+        b.data[0] = 1;
+    }
+    return curve_Fr(b);
+}
+
+static void accumulate_miller_loop(curve_Fq12& acc, const curve_G1& P, const G2_precomp<curve_pp>& Q)
+{
+    // e(0, Q) == 1
+    if (!P.is_zero()) {
+        acc = acc * curve_pp::miller_loop(curve_pp::precompute_G1(P), Q);
+    }
+}
+
+// Verifies the PHGR13 equations of all proofs at once. Each proof's five
+// pairing equations are raised to independent random powers and
+// multiplied together. Terms against a fixed verification key element
+// collapse into one Miller loop per element, the terms against each
+// proof's g_B.g collapse into one Miller loop per proof, and a single
+// final exponentiation is shared by the whole batch.
+static bool batch_verify(
+    const r1cs_ppzksnark_verification_key<curve_pp>& vk,
+    const r1cs_ppzksnark_processed_verification_key<curve_pp>& pvk,
+    const std::vector<const ProofBatch::Entry*>& entries
+)
+{
+    curve_G1 sum_alphaA = curve_G1::zero();
+    curve_G1 sum_one = curve_G1::zero();
+    curve_G1 sum_alphaC = curve_G1::zero();
+    curve_G1 sum_rC_Z = curve_G1::zero();
+    curve_G1 sum_gamma = curve_G1::zero();
+    curve_G1 sum_gamma_beta = curve_G1::zero();
+    curve_Fq12 ml = curve_Fq12::one();
+
+    for (const ProofBatch::Entry* e : entries) {
+        const r1cs_ppzksnark_proof<curve_pp>& proof = e->proof;
+        const curve_G1 acc = pvk.encoded_IC_query.template accumulate_chunk<curve_Fr>(
+            e->primary_input.begin(), e->primary_input.end(), 0).first;
+        const curve_G1 A_acc = proof.g_A.g + acc;
+
+        const curve_Fr r_A = random_batch_scalar();
+        const curve_Fr r_B = random_batch_scalar();
+        const curve_Fr r_C = random_batch_scalar();
+        const curve_Fr r_QAP = random_batch_scalar();
+        const curve_Fr r_K = random_batch_scalar();
+
+        // e(A, alphaA) = e(A', g2)
+        sum_alphaA = sum_alphaA + r_A * proof.g_A.g;
+        sum_one = sum_one - r_A * proof.g_A.h;
+        // e(alphaB_g1, B) = e(B', g2)
+        sum_one = sum_one - r_B * proof.g_B.h;
+        // e(C, alphaC) = e(C', g2)
+        sum_alphaC = sum_alphaC + r_C * proof.g_C.g;
+        sum_one = sum_one - r_C * proof.g_C.h;
+        // e(A + acc, B) = e(H, rC_Z) e(C, g2)
+        sum_rC_Z = sum_rC_Z - r_QAP * proof.g_H;
+        sum_one = sum_one - r_QAP * proof.g_C.g;
+        // e(K, gamma) = e(A + acc + C, gamma_beta_g2) e(gamma_beta_g1, B)
+        sum_gamma = sum_gamma + r_K * proof.g_K;
+        sum_gamma_beta = sum_gamma_beta - r_K * (A_acc + proof.g_C.g);
+
+        const curve_G1 B_side = r_B * vk.alphaB_g1 + r_QAP * A_acc - r_K * vk.gamma_beta_g1;
+        accumulate_miller_loop(ml, B_side, curve_pp::precompute_G2(proof.g_B.g));
+    }
+
+    accumulate_miller_loop(ml, sum_alphaA, pvk.vk_alphaA_g2_precomp);
+    accumulate_miller_loop(ml, sum_one, pvk.pp_G2_one_precomp);
+    accumulate_miller_loop(ml, sum_alphaC, pvk.vk_alphaC_g2_precomp);
+    accumulate_miller_loop(ml, sum_rC_Z, pvk.vk_rC_Z_g2_precomp);
+    accumulate_miller_loop(ml, sum_gamma, pvk.vk_gamma_g2_precomp);
+    accumulate_miller_loop(ml, sum_gamma_beta, pvk.vk_gamma_beta_g2_precomp);
+
+    return curve_pp::final_exponentiation(ml) == curve_GT::one();
+}
+
+bool ProofVerifier::VerifyBatch() {
+    if (!batch) {
+        return true;
+    }
+
+    std::vector<ProofBatch::Entry> entries;
+    entries.swap(batch->entries);
+
+    // Proofs can only share Miller loops when made against the same key.
+    std::map<const r1cs_ppzksnark_processed_verification_key<curve_pp>*,
+             std::vector<const ProofBatch::Entry*>> groups;
+    for (const ProofBatch::Entry& e : entries) {
+        groups[e.pvk].push_back(&e);
+    }
+
+    bool fAllOk = true;
+    for (const auto& group : groups) {
+        const ProofBatch::Entry* first = group.second.front();
+        if (batch_verify(*first->vk, *first->pvk, group.second)) {
+            continue;
+        }
+        for (const ProofBatch::Entry* e : group.second) {
+            if (!r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(*e->pvk, e->primary_input, e->proof)) {
+                fAllOk = false;
+            }
+        }
+    }
+    return fAllOk;
+}
+
 template<>
 bool ProofVerifier::check(
     const r1cs_ppzksnark_verification_key<curve_pp>& vk,
@@ -241,11 +377,25 @@ bool ProofVerifier::check(
     const r1cs_ppzksnark_proof<curve_pp>& proof
 )
 {
-    if (perform_verification) {
-        return r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(pvk, primary_input, proof);
-    } else {
+    if (!perform_verification) {
         return true;
     }
+    if (!batch) {
+        return r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(pvk, primary_input, proof);
+    }
+
+    // The cheap structural checks of the strong IC verifier are done
+    // right away; only the pairings are deferred.
+    if (primary_input.size() != pvk.encoded_IC_query.domain_size() || !proof.is_well_formed()) {
+        return false;
+    }
+    ProofBatch::Entry e;
+    e.vk = &vk;
+    e.pvk = &pvk;
+    e.primary_input = primary_input;
+    e.proof = proof;
+    batch->entries.push_back(e);
+    return true;
 }
 
 }
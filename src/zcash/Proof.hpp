@@ -4,6 +4,8 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <memory>
+
 namespace libzcash {
 
 const unsigned char G1_PREFIX_MASK = 0x02;
@@ -237,11 +239,16 @@ public:
 
 void initialize_curve_params();
 
+class ProofBatch;
+
 class ProofVerifier {
 private:
     bool perform_verification;
+    std::shared_ptr<ProofBatch> batch;
 
     ProofVerifier(bool perform_verification) : perform_verification(perform_verification) { }
+    ProofVerifier(bool perform_verification, std::shared_ptr<ProofBatch> batch) :
+        perform_verification(perform_verification), batch(batch) { }
 
 public:
     // ProofVerifier should never be copied
@@ -259,6 +266,17 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Creates a verification context that defers the pairing
+    // checks of every proof passed to it until VerifyBatch(),
+    // which verifies all of them with a single combined check.
+    static ProofVerifier Batch();
+
+    // Verifies and clears the proofs deferred by a Batch()
+    // context. If the combined check fails, each proof is
+    // verified individually; returns false if any is invalid.
+    // Always true for other contexts.
+    bool VerifyBatch();
+
     template <typename VerificationKey,
               typename ProcessedVerificationKey,
               typename PrimaryInput,
@@ -266,6 +266,37 @@ double benchmark_try_decrypt_notes(size_t nAddrs)
     return timer_stop(tv_start);
 }
 
+// Baseline for benchmark_try_decrypt_notes: trial-decrypts the way FindMyNotes
+// used to, with a DH per ciphertext and key and an exception per miss.
+double benchmark_try_decrypt_notes_unbatched(size_t nAddrs)
+{
+    std::vector<ZCNoteDecryption> decryptors;
+    for (int i = 0; i < nAddrs; i++) {
+        auto sk = libzcash::SpendingKey::random();
+        decryptors.push_back(ZCNoteDecryption(sk.viewing_key()));
+    }
+
+    auto sk = libzcash::SpendingKey::random();
+    auto tx = GetValidReceive(*pzcashParams, sk, 10, true);
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (const JSDescription& jsdesc : tx.vjoinsplit) {
+        auto hSig = jsdesc.h_sig(*pzcashParams, tx.joinSplitPubKey);
+        for (uint8_t j = 0; j < jsdesc.ciphertexts.size(); j++) {
+            for (const ZCNoteDecryption& dec : decryptors) {
+                try {
+                    libzcash::NotePlaintext::decrypt(dec, jsdesc.ciphertexts[j],
+                                                     jsdesc.ephemeralKey, hSig, j);
+                    break;
+                } catch (const libzcash::note_decryption_failed &err) {
+                }
+            }
+        }
+    }
+    return timer_stop(tv_start);
+}
+
 double benchmark_increment_note_witnesses(size_t nTxs)
 {
     CWallet wallet;
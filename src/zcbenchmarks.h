@@ -14,6 +14,7 @@ extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
 extern double benchmark_verify_equihash();
 extern double benchmark_large_tx();
 extern double benchmark_try_decrypt_notes(size_t nAddrs);
+extern double benchmark_try_decrypt_notes_unbatched(size_t nAddrs);
 extern double benchmark_increment_note_witnesses(size_t nTxs);
 
 #endif